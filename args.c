@@ -1,7 +1,41 @@
+// strdup, strnlen and madvise are POSIX or BSD additions that strict ISO
+// modes (-std=c11) hide unless asked for before any include
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+#ifndef _DARWIN_C_SOURCE
+#define _DARWIN_C_SOURCE
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define ARGS_X86_SIMD 1
+#include <immintrin.h>
+#else
+#define ARGS_X86_SIMD 0
+#endif
+
+// Lines at least this long are tokenized by scanargs rather than nextarg
+#define ARGS_SCAN_MIN 64
+
+// Target size of the line-aligned chunks a mapped file is split into, and
+// the smallest block a worker's arena allocates
+#define ARGS_CHUNK 1048576
+#define ARGS_ARENA_BLOCK 4194304
 
 /**
  * A structure that contains five bytes. Two characters behind, the
@@ -30,14 +64,14 @@ typedef struct ReadAhead {
  * @param data the ReadAhead structure to populate
  * @param pos the pointer to the current position within a string
  * @param start a pointer to the start of the string
- * @param end a pointer to the end of the string
+ * @param end a pointer just past the last character of the string
  */
 void sense(ReadAhead *data, char *pos, char *start, char *end) {
-  data->prevPrev = (pos > start + 2) ? *(pos - 2) : '\0';
-  data->prev = (pos > start + 1) ? *(pos - 1) : '\0';
+  data->prevPrev = (pos > start + 1) ? *(pos - 2) : '\0';
+  data->prev = (pos > start) ? *(pos - 1) : '\0';
   data->cur = *pos;
-  data->next = (pos + 1) != end ? *(pos + 1) : '\0';
-  data->nextNext = (pos + 2) != end ? *(pos + 2) : '\0';
+  data->next = (pos + 1) < end ? *(pos + 1) : '\0';
+  data->nextNext = (pos + 2) < end ? *(pos + 2) : '\0';
 }
 
 /**
@@ -69,7 +103,7 @@ void truncateInPlace(char *before) {
   if (before && after) {
     while (*bb) {
       sense(&ra, bb, before, before + strlen(before));
-      if (ra.cur == '*' && ra.next == '"') {
+      if ((ra.cur == '*' || ra.cur == '\\') && ra.next == '"') {
         bb++;
         continue;
       }
@@ -89,7 +123,7 @@ static int setargs(char *args, char **argv)
   int count = 0;
   short inQuote = 0;
   char *start = args;
-  char *end = start + (strlen(args) - 1);
+  char *end = start + strlen(args);
   ReadAhead ra;
   memset(&ra, 0L, sizeof(ReadAhead));
 
@@ -131,51 +165,969 @@ static int setargs(char *args, char **argv)
   return count;
 }
 
+/**
+ * A single argument found by nextarg: a pointer into the tokenized buffer
+ * and the number of bytes in the argument. The byte after it is always a
+ * null character, so ptr can be used as a C string as well.
+ */
+typedef struct ArgSpan {
+  char *ptr;
+  size_t len;
+} ArgSpan;
+
+/**
+ * A reusable list of arguments. The buffer holds the tokenized copy of the
+ * last line handed to parseargline and every span points into it. Both the
+ * buffer and the spans only ever grow, so parsing line after line with the
+ * same list stops allocating once it has seen its longest line.
+ */
+typedef struct ArgList {
+  char *buffer;       // tokenized copy of the current line
+  size_t bufferSize;  // bytes allocated for buffer
+  ArgSpan *spans;     // one span per argument
+  int count;          // arguments in spans
+  int capacity;       // spans allocated
+} ArgList;
+
+/**
+ * The whitespace isspace() reports in the C locale, without the locale
+ * lookup or the undefined behavior of passing it a negative char.
+ * 
+ * @param c the character to test
+ * @return non-zero if c separates arguments
+ */
+static int isargspace(char c) {
+  return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+/**
+ * Reads the next argument at *cursor in one pass. Whitespace outside of
+ * quotes ends an argument; a quotation mark toggles quoting unless the
+ * character before it is an asterisk (*) or backslash (\\). Such an escape
+ * is removed as the argument is read, and the argument is shifted down over
+ * it and null terminated in place. Quotation marks themselves are kept, as
+ * setargs keeps them.
+ * 
+ * @param cursor position to read from; left just past the argument
+ * @param end the end of the string, which must hold a null character
+ * @param span receives the argument
+ * @return 1 if an argument was read, 0 if only whitespace remained
+ */
+static int nextarg(char **cursor, char *end, ArgSpan *span) {
+  char *read = *cursor;
+  char *write;
+  short inQuote = 0;
+  char prev = '\0';
+  
+  while (read < end && isargspace(*read)) ++read;
+  if (read >= end) {
+    *cursor = end;
+    return 0;
+  }
+  
+  span->ptr = write = read;
+  while (read < end && (inQuote || !isargspace(*read))) {
+    if (*read == '"' && prev != '\\' && prev != '*') inQuote = !inQuote;
+    
+    // Drop the escape but remember it so the quote after it is literal
+    if ((*read == '*' || *read == '\\') && read + 1 < end && read[1] == '"') {
+      prev = *read++;
+      continue;
+    }
+    
+    prev = *read;
+    *write++ = *read++;
+  }
+  
+  span->len = (size_t)(write - span->ptr);
+  *cursor = read < end ? read + 1 : end;
+  *write = '\0';
+  return 1;
+}
+
+/**
+ * Appends span to list, doubling its spans array whenever it fills.
+ * 
+ * @param list the list to append to
+ * @param span the argument to append
+ * @return 0 on success, or -1 if memory ran out
+ */
+static int appendarg(ArgList *list, const ArgSpan *span) {
+  ArgSpan *grown;
+  int capacity;
+  
+  if (list->count == list->capacity) {
+    capacity = list->capacity ? list->capacity * 2 : 16;
+    grown = realloc(list->spans, capacity * sizeof(ArgSpan));
+    if (!grown) return -1;
+    list->spans = grown;
+    list->capacity = capacity;
+  }
+  
+  list->spans[list->count++] = *span;
+  return 0;
+}
+
+void initarglist(ArgList *list) {
+  memset(list, 0L, sizeof(ArgList));
+}
+
+void freearglist(ArgList *list) {
+  free(list->buffer);
+  free(list->spans);
+  initarglist(list);
+}
+
+/**
+ * Tokenizes args in place with nextarg, appending its arguments to list.
+ * 
+ * @param args the string to tokenize; it is modified
+ * @param length the number of bytes in args, which must be followed by a
+ * null character
+ * @param list the list to append to
+ * @return the number of arguments in list, or -1 if memory ran out
+ */
+int tokenizeargs(char *args, size_t length, ArgList *list) {
+  char *cursor = args;
+  ArgSpan span;
+  
+  while (nextarg(&cursor, args + length, &span)) {
+    if (appendarg(list, &span) < 0) return -1;
+  }
+  
+  return list->count;
+}
+
+/**
+ * Bitmasks describing 64 bytes of input, bit n standing for byte n.
+ */
+typedef struct ArgMasks {
+  uint64_t space;   // whitespace as isargspace sees it
+  uint64_t quote;   // quotation marks
+  uint64_t escape;  // asterisks and backslashes
+} ArgMasks;
+
+#if ARGS_X86_SIMD
+static void classifyargs_sse2(const char *block, ArgMasks *masks) {
+  const __m128i tab = _mm_set1_epi8((char)(0x80 - '\t'));
+  const __m128i controls = _mm_set1_epi8((char)(0x80 + 5));
+  __m128i v;
+  int i;
+  
+  memset(masks, 0L, sizeof(ArgMasks));
+  for (i = 0; i < 64; i += 16) {
+    v = _mm_loadu_si128((const __m128i *)(block + i));
+    
+    // \t through \r become the five smallest signed bytes after the add
+    masks->space |= (uint64_t)(unsigned int)_mm_movemask_epi8(_mm_or_si128(
+      _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+      _mm_cmpgt_epi8(controls, _mm_add_epi8(v, tab))
+    )) << i;
+    masks->quote |= (uint64_t)(unsigned int)_mm_movemask_epi8(
+      _mm_cmpeq_epi8(v, _mm_set1_epi8('"'))
+    ) << i;
+    masks->escape |= (uint64_t)(unsigned int)_mm_movemask_epi8(_mm_or_si128(
+      _mm_cmpeq_epi8(v, _mm_set1_epi8('*')),
+      _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))
+    )) << i;
+  }
+}
+
+__attribute__((target("avx2")))
+static void classifyargs_avx2(const char *block, ArgMasks *masks) {
+  const __m256i tab = _mm256_set1_epi8((char)(0x80 - '\t'));
+  const __m256i controls = _mm256_set1_epi8((char)(0x80 + 5));
+  __m256i v;
+  int i;
+  
+  memset(masks, 0L, sizeof(ArgMasks));
+  for (i = 0; i < 64; i += 32) {
+    v = _mm256_loadu_si256((const __m256i *)(block + i));
+    
+    masks->space |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_or_si256(
+      _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+      _mm256_cmpgt_epi8(controls, _mm256_add_epi8(v, tab))
+    )) << i;
+    masks->quote |= (uint64_t)(uint32_t)_mm256_movemask_epi8(
+      _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"'))
+    ) << i;
+    masks->escape |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_or_si256(
+      _mm256_cmpeq_epi8(v, _mm256_set1_epi8('*')),
+      _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'))
+    )) << i;
+  }
+}
+#else
+static void classifyargs_scalar(const char *block, ArgMasks *masks) {
+  int i;
+  
+  memset(masks, 0L, sizeof(ArgMasks));
+  for (i = 0; i < 64; i++) {
+    masks->space |= (uint64_t)(isargspace(block[i]) != 0) << i;
+    masks->quote |= (uint64_t)(block[i] == '"') << i;
+    masks->escape |= (uint64_t)(block[i] == '*' || block[i] == '\\') << i;
+  }
+}
+#endif
+
+static void classifyargs_resolve(const char *block, ArgMasks *masks);
+
+// Classifier for this CPU, picked on first use. Worker threads may race to
+// pick it, so it is read and written atomically.
+static void (*classifyargs)(const char *, ArgMasks *) = classifyargs_resolve;
+
+static void classifyargs_resolve(const char *block, ArgMasks *masks) {
+  void (*classify)(const char *, ArgMasks *);
+  
+#if ARGS_X86_SIMD
+  __builtin_cpu_init();
+  classify = __builtin_cpu_supports("avx2") 
+    ? classifyargs_avx2 
+    : classifyargs_sse2;
+#else
+  classify = classifyargs_scalar;
+#endif
+  
+  __atomic_store_n(&classifyargs, classify, __ATOMIC_RELAXED);
+  classify(block, masks);
+}
+
+/**
+ * Sets every bit at or above each set bit of x an odd number of times,
+ * turning a mask of quotation marks into a mask of the quoted bytes.
+ * 
+ * @param x the mask of opening and closing quotation marks
+ * @return the running parity of x
+ */
+static uint64_t prefixxor(uint64_t x) {
+  x ^= x << 1;
+  x ^= x << 2;
+  x ^= x << 4;
+  x ^= x << 8;
+  x ^= x << 16;
+  x ^= x << 32;
+  return x;
+}
+
+/**
+ * Removes each asterisk or backslash that precedes a quotation mark, as
+ * nextarg does while it reads.
+ * 
+ * @param arg the argument to rewrite in place
+ * @param len the number of bytes in arg
+ * @return the new length of arg
+ */
+static size_t unescapearg(char *arg, size_t len) {
+  size_t read;
+  size_t write = 0;
+  
+  for (read = 0; read < len; read++) {
+    if ((arg[read] == '*' || arg[read] == '\\') 
+      && read + 1 < len && arg[read + 1] == '"') continue;
+    arg[write++] = arg[read];
+  }
+  
+  return write;
+}
+
+/**
+ * Vectorized counterpart of tokenizeargs, producing the same arguments.
+ * Each 64 byte block is classified into whitespace, quote and escape
+ * masks. Escaped quotes are the quotes right after an escape, the quoted
+ * bytes are the prefix XOR of the rest, and whitespace outside of them
+ * separates arguments. Argument starts and ends then fall out of the
+ * separator mask and are visited a set bit at a time. Arguments that held
+ * an escaped quote are rewritten afterwards; the rest are only terminated.
+ * 
+ * @param args the string to tokenize; it is modified
+ * @param length the number of bytes in args, which must be followed by a
+ * null character
+ * @param list the list to append to
+ * @return the number of arguments in list, or -1 if memory ran out
+ */
+int scanargs(char *args, size_t length, ArgList *list) {
+  ArgMasks masks;
+  ArgSpan span;
+  char tail[64];
+  const char *block;
+  uint64_t escaped, quoted, words, starts, ends, drops, events;
+  uint64_t escapeCarry = 0;   // last byte of the previous block escapes
+  uint64_t quoteCarry = 0;    // all ones while a quote is still open
+  uint64_t wordCarry = 0;     // last byte of the previous block is a word
+  size_t lastDrop = (size_t)-1;
+  size_t start = 0;
+  size_t at;
+  size_t i;
+  
+  for (i = 0; i < length; i += 64) {
+    // Spaces pad the final block so an argument ending there is closed
+    if (length - i >= 64) block = args + i;
+    else {
+      memset(tail, ' ', sizeof(tail));
+      memcpy(tail, args + i, length - i);
+      block = tail;
+    }
+    __atomic_load_n(&classifyargs, __ATOMIC_RELAXED)(block, &masks);
+    
+    escaped = masks.quote & ((masks.escape << 1) | escapeCarry);
+    quoted = prefixxor(masks.quote & ~escaped) ^ quoteCarry;
+    words = ~(masks.space & ~quoted);
+    starts = words & ~((words << 1) | wordCarry);
+    ends = ~words & ((words << 1) | wordCarry);
+    
+    // Escapes to remove; the quote after the last byte is in the next block
+    drops = masks.escape & ((masks.quote >> 1) 
+      | ((uint64_t)(i + 64 < length && args[i + 64] == '"') << 63));
+    if (drops) lastDrop = i + 63 - (size_t)__builtin_clzll(drops);
+    
+    escapeCarry = masks.escape >> 63;
+    quoteCarry = (uint64_t)0 - (quoted >> 63);
+    wordCarry = words >> 63;
+    
+    // A byte cannot both start and end an argument, so events alternate
+    for (events = starts | ends; events; events &= events - 1) {
+      at = i + (size_t)__builtin_ctzll(events);
+      if ((starts >> (at - i)) & 1) {
+        start = at;
+        continue;
+      }
+      
+      span.ptr = args + start;
+      span.len = at - start;
+      if (lastDrop != (size_t)-1 && lastDrop >= start) {
+        span.len = unescapearg(span.ptr, span.len);
+      }
+      span.ptr[span.len] = '\0';
+      if (appendarg(list, &span) < 0) return -1;
+    }
+  }
+  
+  // An argument still open runs to the end, as an unclosed quote does
+  if (wordCarry) {
+    span.ptr = args + start;
+    span.len = length - start;
+    if (lastDrop != (size_t)-1 && lastDrop >= start) {
+      span.len = unescapearg(span.ptr, span.len);
+    }
+    span.ptr[span.len] = '\0';
+    if (appendarg(list, &span) < 0) return -1;
+  }
+  
+  return list->count;
+}
+
+/**
+ * Tokenizes args in place with whichever of nextarg and scanargs suits
+ * its length, appending its arguments to list.
+ * 
+ * @param args the string to tokenize; it is modified
+ * @param length the number of bytes in args, which must be followed by a
+ * null character
+ * @param list the list to append to
+ * @return the number of arguments in list, or -1 if memory ran out
+ */
+static int tokenizeline(char *args, size_t length, ArgList *list) {
+  return length >= ARGS_SCAN_MIN 
+    ? scanargs(args, length, list) 
+    : tokenizeargs(args, length, list);
+}
+
+/**
+ * Replaces the contents of list with the arguments of line. The line is
+ * copied into the list's own buffer, so it is left untouched and may be
+ * reused as soon as this returns.
+ * 
+ * @param list the list to fill
+ * @param line the line to parse; it need not be null terminated
+ * @param length the number of bytes in line
+ * @return the number of arguments, or -1 if memory ran out
+ */
+int parseargline(ArgList *list, const char *line, size_t length) {
+  char *grown;
+  size_t size;
+  
+  list->count = 0;
+  if (length + 1 > list->bufferSize) {
+    size = list->bufferSize ? list->bufferSize : 64;
+    while (size < length + 1) size *= 2;
+    grown = realloc(list->buffer, size);
+    if (!grown) return -1;
+    list->buffer = grown;
+    list->bufferSize = size;
+  }
+  
+  memcpy(list->buffer, line, length);
+  list->buffer[length] = '\0';
+  
+  return tokenizeline(list->buffer, length, list);
+}
+
+/**
+ * Splits args into a null terminated argv in a single allocation. An
+ * argument and the whitespace after it take at least two bytes, which
+ * bounds the number of pointers; the copy of args follows them.
+ * 
+ * @param args the string to parse; it is not modified
+ * @param argc receives the number of arguments
+ * @return the arguments, to be released with freeparsedargs, or NULL if
+ * there were none
+ */
 char **parsedargs(char *args, int *argc)
 {
-   char **argv = NULL;
-   int    argn = 0;
+  char **argv = NULL;
+  int argn = 0;
+  size_t length;
+  size_t slots;
+  char *copy;
+  char *cursor;
+  ArgSpan span;
+  
+  if (args && *args) {
+    length = strlen(args);
+    slots = length / 2 + 3;
+    argv = malloc(slots * sizeof(char *) + length + 1);
+  }
+  
+  if (argv) {
+    copy = cursor = (char *)(argv + slots);
+    memcpy(copy, args, length + 1);
+    *argv++ = copy;
+    
+    while (nextarg(&cursor, copy + length, &span)) argv[argn++] = span.ptr;
+    argv[argn] = NULL;
+    
+    if (!argn) {
+      free(argv - 1);
+      argv = NULL;
+    }
+  }
+  
+  *argc = argn;
+  return argv;
+}
+
+void freeparsedargs(char **argv)
+{
+  if (argv) free(argv - 1);
+}
+
+/**
+ * A bump allocator owned by one worker thread. Blocks are chained and all
+ * released together, so nothing it hands out is freed on its own.
+ */
+typedef struct ArgArenaBlock {
+  struct ArgArenaBlock *next;  // previously filled block
+  size_t size;                 // bytes available in data
+  size_t used;                 // bytes handed out so far
+  char data[];
+} ArgArenaBlock;
+
+typedef struct ArgArena {
+  ArgArenaBlock *head;         // block currently being bumped
+} ArgArena;
+
+/**
+ * One line-aligned piece of a mapped file and, once ready is set, its
+ * arguments. Every line owns counts[line] consecutive entries of spans.
+ */
+typedef struct ArgChunk {
+  const char *start;   // first byte in the mapping
+  size_t length;       // bytes up to and including the last newline
+  size_t lines;        // lines in the chunk
+  int *counts;         // arguments on each line
+  ArgSpan *spans;      // arguments of every line, in order
+  int failed;          // memory ran out while parsing
+  int ready;           // set by the worker, guarded by the file's lock
+} ArgChunk;
+
+struct ArgFile;
+
+/**
+ * A parsing thread. Its chunks are the range packed into range, the next
+ * one in the low 32 bits and the end in the high 32 bits. The owner takes
+ * from the front and idle workers steal from the back, each with a single
+ * compare and swap.
+ */
+typedef struct ArgWorker {
+  uint64_t range;          // [next, end) of chunk indexes, atomic
+  ArgArena arena;          // holds the text and spans of its chunks
+  ArgList list;            // scratch spans, reused for every line
+  int *counts;             // scratch argument counts per line
+  size_t countCapacity;    // entries allocated in counts
+  pthread_t thread;
+  struct ArgFile *file;
+} ArgWorker;
+
+/**
+ * A memory-mapped file of command lines being tokenized in parallel.
+ * Chunks finish in any order; nextargchunk hands them out in file order.
+ */
+typedef struct ArgFile {
+  char *map;               // the mapped file
+  size_t size;             // bytes in the mapping
+  ArgChunk *chunks;        // line-aligned pieces of the file
+  size_t chunkCount;       // entries in chunks
+  size_t nextChunk;        // next chunk nextargchunk returns
+  ArgWorker *workers;
+  int workerCount;         // entries in workers, each owning a range
+  int started;             // workers running on a thread of their own
+  pthread_mutex_t lock;    // guards every chunk's ready flag
+  pthread_cond_t done;     // signaled as chunks become ready
+} ArgFile;
+
+void closeargfile(ArgFile *file);
+
+static void *arenaalloc(ArgArena *arena, size_t size) {
+  ArgArenaBlock *block = arena->head;
+  size_t bytes;
+  void *result;
+  
+  size = (size + 15) & ~(size_t)15;
+  if (!block || block->size - block->used < size) {
+    bytes = size > ARGS_ARENA_BLOCK ? size : ARGS_ARENA_BLOCK;
+    block = malloc(sizeof(ArgArenaBlock) + bytes);
+    if (!block) return NULL;
+    block->next = arena->head;
+    block->size = bytes;
+    block->used = 0;
+    arena->head = block;
+  }
+  
+  result = block->data + block->used;
+  block->used += size;
+  return result;
+}
+
+static void freearena(ArgArena *arena) {
+  ArgArenaBlock *block;
+  
+  while ((block = arena->head)) {
+    arena->head = block->next;
+    free(block);
+  }
+}
+
+/**
+ * Takes a chunk index from a worker's range: the front one for its owner,
+ * the back one for a thief.
+ * 
+ * @param worker the worker whose range to take from
+ * @param steal non-zero to take from the back
+ * @return the chunk index, or -1 if the range was empty
+ */
+static long takechunk(ArgWorker *worker, int steal) {
+  uint64_t range = __atomic_load_n(&worker->range, __ATOMIC_ACQUIRE);
+  uint64_t next, end;
+  
+  for (;;) {
+    next = range & 0xFFFFFFFF;
+    end = range >> 32;
+    if (next >= end) return -1;
+    
+    if (__atomic_compare_exchange_n(
+      &worker->range, 
+      &range, 
+      steal ? (next | ((end - 1) << 32)) : ((next + 1) | (end << 32)),
+      0, 
+      __ATOMIC_ACQ_REL, 
+      __ATOMIC_ACQUIRE
+    )) return (long)(steal ? end - 1 : next);
+  }
+}
+
+/**
+ * Copies a chunk into the worker's arena and tokenizes it line by line,
+ * exactly as parsedargs would tokenize each line on its own. The spans and
+ * counts gathered in the worker's scratch space are then copied into the
+ * arena alongside the text.
+ * 
+ * @param worker the worker doing the parsing
+ * @param chunk the chunk to parse
+ * @return 0 on success, or -1 if memory ran out
+ */
+static int parsechunk(ArgWorker *worker, ArgChunk *chunk) {
+  char *text = arenaalloc(&worker->arena, chunk->length + 1);
+  char *line, *newline, *end;
+  size_t length;
+  int before;
+  int *grown;
+  
+  if (!text) return -1;
+  memcpy(text, chunk->start, chunk->length);
+  text[chunk->length] = '\0';
+  end = text + chunk->length;
+  
+  worker->list.count = 0;
+  chunk->lines = 0;
+  for (line = text; line < end; line = newline + 1) {
+    newline = memchr(line, '\n', (size_t)(end - line));
+    if (!newline) newline = end;
+    *newline = '\0';
+    
+    // parsedargs stops at the first null character, so this does too
+    length = strnlen(line, (size_t)(newline - line));
+    before = worker->list.count;
+    if (tokenizeline(line, length, &worker->list) < 0) return -1;
+    
+    if (chunk->lines == worker->countCapacity) {
+      worker->countCapacity = worker->countCapacity 
+        ? worker->countCapacity * 2 
+        : 1024;
+      grown = realloc(worker->counts, worker->countCapacity * sizeof(int));
+      if (!grown) return -1;
+      worker->counts = grown;
+    }
+    worker->counts[chunk->lines++] = worker->list.count - before;
+  }
+  
+  chunk->counts = arenaalloc(&worker->arena, chunk->lines * sizeof(int));
+  chunk->spans = arenaalloc(
+    &worker->arena, 
+    worker->list.count * sizeof(ArgSpan)
+  );
+  if (!chunk->counts || !chunk->spans) return -1;
+  
+  memcpy(chunk->counts, worker->counts, chunk->lines * sizeof(int));
+  memcpy(
+    chunk->spans, 
+    worker->list.spans, 
+    worker->list.count * sizeof(ArgSpan)
+  );
+  return 0;
+}
+
+/**
+ * Worker thread body: drains its own range, then steals from the others
+ * until every range is empty.
+ * 
+ * @param context the ArgWorker to run
+ * @return NULL
+ */
+static void *runworker(void *context) {
+  ArgWorker *worker = context;
+  ArgFile *file = worker->file;
+  ArgChunk *chunk;
+  long index;
+  int self = (int)(worker - file->workers);
+  int victim;
+  
+  for (;;) {
+    index = takechunk(worker, 0);
+    for (victim = 1; index < 0 && victim < file->workerCount; victim++) {
+      index = takechunk(
+        &file->workers[(self + victim) % file->workerCount], 
+        1
+      );
+    }
+    if (index < 0) break;
+    
+    chunk = &file->chunks[index];
+    chunk->failed = parsechunk(worker, chunk) < 0;
+    
+    pthread_mutex_lock(&file->lock);
+    chunk->ready = 1;
+    pthread_cond_broadcast(&file->done);
+    pthread_mutex_unlock(&file->lock);
+  }
+  
+  return NULL;
+}
+
+/**
+ * Maps path and starts tokenizing it on threads workers. The file is cut
+ * into chunks of about ARGS_CHUNK bytes that end on a newline, and each
+ * worker starts out owning an equal run of them.
+ * 
+ * @param file the ArgFile to set up
+ * @param path the file of command lines to parse
+ * @param threads the number of workers, at least one
+ * @return 0 on success, or -1 with errno set
+ */
+int openargfile(ArgFile *file, const char *path, int threads)
+{
+  struct stat info;
+  const char *newline;
+  size_t at, end;
+  int fd, i;
+  
+  memset(file, 0L, sizeof(ArgFile));
+  if (threads < 1) threads = 1;
+  
+  fd = open(path, O_RDONLY);
+  if (fd < 0) return -1;
+  if (fstat(fd, &info) < 0) {
+    close(fd);
+    return -1;
+  }
+  
+  file->size = (size_t)info.st_size;
+  if (file->size) {
+    file->map = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (file->map == MAP_FAILED) {
+      file->map = NULL;
+      close(fd);
+      return -1;
+    }
+    madvise(file->map, file->size, MADV_SEQUENTIAL);
+  }
+  close(fd);
+  
+  // Every chunk but the last is at least ARGS_CHUNK bytes long
+  file->chunks = calloc(file->size / ARGS_CHUNK + 1, sizeof(ArgChunk));
+  file->workers = calloc((size_t)threads, sizeof(ArgWorker));
+  if (!file->chunks || !file->workers) {
+    closeargfile(file);
+    errno = ENOMEM;
+    return -1;
+  }
+  
+  for (at = 0; at < file->size; at = end) {
+    end = file->size - at > ARGS_CHUNK ? at + ARGS_CHUNK : file->size;
+    newline = memchr(file->map + end - 1, '\n', file->size - end + 1);
+    end = newline ? (size_t)(newline - file->map) + 1 : file->size;
+    
+    file->chunks[file->chunkCount].start = file->map + at;
+    file->chunks[file->chunkCount++].length = end - at;
+  }
+  
+  pthread_mutex_init(&file->lock, NULL);
+  pthread_cond_init(&file->done, NULL);
+  
+  file->workerCount = threads;
+  for (i = 0; i < threads; i++) {
+    file->workers[i].range = (file->chunkCount * (size_t)i / threads)
+      | ((uint64_t)(file->chunkCount * (size_t)(i + 1) / threads) << 32);
+    file->workers[i].file = file;
+    initarglist(&file->workers[i].list);
+  }
+  
+  // Ranges of workers that fail to start are stolen by the running ones
+  for (i = 0; i < threads; i++) {
+    if (pthread_create(
+      &file->workers[i].thread, 
+      NULL, 
+      runworker, 
+      &file->workers[i]
+    )) break;
+    file->started = i + 1;
+  }
+  
+  if (!file->started) runworker(&file->workers[0]);
+  
+  return 0;
+}
+
+/**
+ * Waits for the next chunk in file order.
+ * 
+ * @param file an ArgFile set up by openargfile
+ * @return the chunk, or NULL once every chunk has been returned
+ */
+const ArgChunk *nextargchunk(ArgFile *file)
+{
+  ArgChunk *chunk;
+  
+  if (file->nextChunk >= file->chunkCount) return NULL;
+  chunk = &file->chunks[file->nextChunk++];
+  
+  pthread_mutex_lock(&file->lock);
+  while (!chunk->ready) pthread_cond_wait(&file->done, &file->lock);
+  pthread_mutex_unlock(&file->lock);
+  
+  return chunk;
+}
 
-   if (args && *args
+/**
+ * Waits for the workers, then releases the arenas and unmaps the file.
+ * 
+ * @param file an ArgFile set up by openargfile
+ */
+void closeargfile(ArgFile *file)
+{
+  int i;
+  
+  for (i = 0; i < file->started; i++) {
+    pthread_join(file->workers[i].thread, NULL);
+  }
+  
+  if (file->workerCount) {
+    pthread_mutex_destroy(&file->lock);
+    pthread_cond_destroy(&file->done);
+  }
+  
+  for (i = 0; i < file->workerCount; i++) {
+    freearena(&file->workers[i].arena);
+    freearglist(&file->workers[i].list);
+    free(file->workers[i].counts);
+  }
+  
+  if (file->map) munmap(file->map, file->size);
+  free(file->chunks);
+  free(file->workers);
+  memset(file, 0L, sizeof(ArgFile));
+}
+
+/**
+ * The original two pass parser: setargs counts and then splits the string
+ * and truncateInPlace removes escapes from each argument. It is kept as
+ * the reference that parsedargs must agree with, and is run by passing -r.
+ * 
+ * @param args the string to parse
+ */
+static void printreferenceargs(char *args)
+{
+  char **argv = NULL;
+  int argn = 0;
+  int i;
+  
+  if (args && *args
     && (args = strdup(args))
-    && (argn = setargs(args,NULL))
-    && (argv = malloc((argn+1) * sizeof(char *)))) {
-      *argv++ = args;
-      argn = setargs(args,argv);
-   }
+    && (argn = setargs(args, NULL))
+    && (argv = malloc(argn * sizeof(char *)))) {
+    argn = setargs(args, argv);
+  }
+  
+  printf("== %d\n", argv ? argn : 0);
+  for (i = 0; argv && i < argn; i++) {
+    truncateInPlace(argv[i]);
+    printf("[%s]\n", argv[i]);
+  }
+  
+  free(argv);
+  free(args);
+}
 
-   if (args && !argv) free(args);
+/**
+ * Tokenizes args with scanargs whatever its length, printing the result
+ * in the same form as the other modes. It is run by passing -v.
+ * 
+ * @param args the string to parse
+ */
+static void printscannedargs(char *args)
+{
+  ArgList list;
+  char *copy = strdup(args);
+  int i;
+  
+  initarglist(&list);
+  if (copy && scanargs(copy, strlen(copy), &list) >= 0) {
+    printf("== %d\n", list.count);
+    for (i = 0; i < list.count; i++) printf("[%s]\n", list.spans[i].ptr);
+  }
+  
+  freearglist(&list);
+  free(copy);
+}
 
-   *argc = argn;
-   return argv;
+/**
+ * Prints the arguments of every line of path in file order, parsing the
+ * file on threads workers. It is run by passing -f and matches -s.
+ * 
+ * @param path the file of command lines
+ * @param threads the number of workers
+ * @return 0 on success, or 1 on failure
+ */
+static int printargfile(const char *path, int threads)
+{
+  ArgFile file;
+  const ArgChunk *chunk;
+  const ArgSpan *span;
+  size_t line;
+  int i, failed = 0;
+  
+  if (openargfile(&file, path, threads) < 0) {
+    perror(path);
+    return 1;
+  }
+  
+  while (!failed && (chunk = nextargchunk(&file))) {
+    failed = chunk->failed;
+    span = chunk->spans;
+    for (line = 0; !failed && line < chunk->lines; line++) {
+      printf("== %d\n", chunk->counts[line]);
+      for (i = 0; i < chunk->counts[line]; i++, span++) {
+        putchar('[');
+        fwrite(span->ptr, 1, span->len, stdout);
+        fputs("]\n", stdout);
+      }
+    }
+  }
+  
+  closeargfile(&file);
+  if (failed) fprintf(stderr, "Could not allocate memory!\n");
+  return failed;
 }
 
-void freeparsedargs(char **argv)
+/**
+ * Prints the arguments of every line of path, one parsedargs call per
+ * line. It is the serial reference for -f and is run by passing -s.
+ * 
+ * @param path the file of command lines
+ * @return 0 on success, or 1 on failure
+ */
+static int printserialfile(const char *path)
 {
-  if (argv) {
-    free(argv[-1]);
-    free(argv-1);
-  } 
+  FILE *in = fopen(path, "r");
+  char *line = NULL;
+  size_t size = 0;
+  ssize_t length;
+  char **av;
+  int ac, i;
+  
+  if (!in) {
+    perror(path);
+    return 1;
+  }
+  
+  while ((length = getline(&line, &size, in)) > 0) {
+    if (line[length - 1] == '\n') line[length - 1] = '\0';
+    av = parsedargs(line, &ac);
+    printf("== %d\n", ac);
+    for (i = 0; i < ac; i++) printf("[%s]\n", av[i]);
+    freeparsedargs(av);
+  }
+  
+  free(line);
+  fclose(in);
+  return 0;
 }
 
 int main(int argc, char *argv[])
 {
   int i;
   char **av;
-  char **cav;
   int ac;
   char *as = NULL;
   
+  if (argc > 2 && !strcmp(argv[1], "-r")) {
+    printreferenceargs(argv[2]);
+    exit(0);
+  }
+  
+  if (argc > 2 && !strcmp(argv[1], "-v")) {
+    printscannedargs(argv[2]);
+    exit(0);
+  }
+  
+  if (argc > 2 && !strcmp(argv[1], "-f")) {
+    exit(printargfile(
+      argv[2], 
+      argc > 3 ? atoi(argv[3]) : (int)sysconf(_SC_NPROCESSORS_ONLN)
+    ));
+  }
+  
+  if (argc > 2 && !strcmp(argv[1], "-s")) {
+    exit(printserialfile(argv[2]));
+  }
+  
   if (argc > 1) as = argv[1];
 
   av = parsedargs(as,&ac);
   printf("== %d\n",ac);
   for (i = 0; i < ac; i++) {
-    truncateInPlace(av[i]);
     printf("[%s]\n",av[i]);
   }
 
   freeparsedargs(av);
-  freeparsedargs(cav);
   exit(0);
-}
\ No newline at end of file
+}
@@ -1,7 +1,39 @@
+// strnlen, O_CLOEXEC and MAP_ANONYMOUS are POSIX 2008 or BSD additions that
+// strict ISO modes (-std=c11) hide unless asked for before any include
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+#ifndef _DARWIN_C_SOURCE
+#define _DARWIN_C_SOURCE
+#endif
+
 #include "cstr.h"
+#include <errno.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define CS_X86_SIMD 1
+#include <immintrin.h>
+#else
+#define CS_X86_SIMD 0
+#endif
 
 const char CS_DEFAULT_PADSTRING[] = " ";
 const char CS_EMPTY_STRING[] = "";
+const char CS_DEFAULT_SEPARATOR[] = ",";
 
 const size_t CSSA_NEW      = 1; 
 const size_t CSSA_FREE     = 2; 
@@ -10,14 +42,250 @@ const size_t CSSA_REALLOC  = 8;
 const size_t CSSA_FAILED   = 16;
 const size_t CSSA_HEAP     = 32;
 const size_t CSSA_SKIPPED  = 64;
+const size_t CSSA_INLINE   = 128;
+const size_t CSSA_ARENA    = 256;
+const size_t CSSA_SHARED   = 512;
+const size_t CSSA_SLICE    = 1024;
+const size_t CSSA_INDEXED  = 2048;
+const size_t CSSA_MAPPED   = 4096;
+
+// CSSA_HEAP | INLINE | ARENA | SHARED | SLICE | MAPPED
+const size_t CSSA_STORAGE  = 32 | 128 | 256 | 512 | 1024 | 4096;
+
+// Storage whose bytes may not be written in place
+#define CS_READONLY (CSSA_SHARED | CSSA_SLICE | CSSA_MAPPED)
+
+// Bits that outlive any single operation: the storage mode and whether a
+// code point index is attached
+#define CS_PERSISTENT (CSSA_STORAGE | CSSA_INDEXED)
+
+// Needles at least this long are searched with Two-Way rather than the
+// first/last byte filter
+#define CS_LONG_NEEDLE 64
+
+// Smallest capacity handed out when a builder first grows
+#define CS_MIN_CAPACITY 16
+
+// Default arena chunk size and the alignment of every arena allocation
+#define CS_ARENA_CHUNK 65536
+#define CS_ARENA_ALIGN 16
+
+// Pool size classes run from CS_POOL_MIN to CS_POOL_MAX in steps of 1.5x
+// and 2x; anything larger goes straight to the parent allocator
+#define CS_POOL_MIN     16
+#define CS_POOL_MAX     4096
+#define CS_POOL_CLASSES 17
+#define CS_POOL_SLAB    65536
+
+// Precomputed state for a Two-Way search of one needle
+typedef struct cs_twoWay {
+  size_t suffix;     // critical factorization point
+  size_t period;     // period of the needle, or the shift for aperiodic ones
+  BOOL periodic;     // whether the left half repeats in the right
+  size_t shift[256]; // skip keyed by the byte under the needle's last byte
+} cs_twoWay;
+
+typedef struct cs_arenaChunk {
+  struct cs_arenaChunk *next; // previously filled chunk
+  size_t size;                // bytes available in data
+  size_t used;                // bytes handed out so far
+  char data[];
+} cs_arenaChunk;
+
+struct cs_arena {
+  cs_arenaChunk *head;  // chunk currently being bumped
+  size_t chunkSize;     // minimum size of new chunks
+  char *last;           // most recent allocation, the only one that can grow
+  cs_allocator allocator;      // table handed to StringActions in the arena
+  const cs_allocator *parent;  // where chunks come from
+  size_t allocations;          // allocations since the last reset
+  size_t reserved;             // bytes held in chunks
+  size_t peak;                 // high-water mark of reserved
+};
+
+typedef struct cs_poolSlab {
+  struct cs_poolSlab *next;    // previously carved slab
+} cs_poolSlab;
+
+struct cs_pool {
+  void *freeLists[CS_POOL_CLASSES]; // singly linked free blocks per class
+  cs_poolSlab *slabs;               // slabs carved into blocks
+  char *cursor;                     // next uncarved byte of the newest slab
+  char *limit;                      // end of the newest slab
+  cs_allocator allocator;           // table handed to StringActions
+  const cs_allocator *parent;       // where slabs and large blocks come from
+  cs_allocStats stats;
+};
+
+static void *cs_heap_allocate(void *context, size_t size) {
+  return malloc(size);
+}
+
+static void *cs_heap_reallocate(
+  void *context, 
+  void *memory, 
+  size_t oldSize, 
+  size_t newSize
+) {
+  return realloc(memory, newSize);
+}
+
+static void cs_heap_release(void *context, void *memory, size_t size) {
+  free(memory);
+}
+
+const cs_allocator CS_HEAP_ALLOCATOR = {
+  cs_heap_allocate,
+  cs_heap_reallocate,
+  cs_heap_release,
+  0L
+};
+
+static const cs_allocator *cs_globalAllocator = &CS_HEAP_ALLOCATOR;
+
+static void *cs_arena_allocate(void *context, size_t size);
+static StringAction *cs_copyBytesUsing(
+  const cs_allocator *allocator,
+  const char *bytes,
+  size_t length,
+  size_t maxSize,
+  StringAction *useAction
+);
+
+const cs_allocator *cs_defaultAllocator(void) {
+  return cs_globalAllocator;
+}
+
+void cs_setDefaultAllocator(const cs_allocator *allocator) {
+  cs_globalAllocator = allocator ? allocator : &CS_HEAP_ALLOCATOR;
+}
+
+// Actions zeroed by hand have no allocator; their strings are plain heap
+static const cs_allocator *cs_allocatorOf(StringAction *action) {
+  return action->allocator ? action->allocator : &CS_HEAP_ALLOCATOR;
+}
+
+// Storage bit describing buffers handed out by an allocator
+static size_t cs_storageOf(const cs_allocator *allocator) {
+  return allocator->allocate == cs_arena_allocate ? CSSA_ARENA : CSSA_HEAP;
+}
+
+// Header in front of a copy-on-write buffer; `string` points just past it.
+// Slices point anywhere inside the block and keep the header pointer in
+// their unused inline buffer. A mapped file is shared through a header of
+// its own that stands for the mapping, kept in the inline buffer as well.
+typedef struct cs_shared {
+  size_t refs;                    // actions sharing the block, atomic
+  size_t size;                    // bytes in the block, header included,
+                                  // or in the mapping
+  const cs_allocator *allocator;  // where the block came from
+  char *mapping;                  // mapped file, 0L for a heap block
+} cs_shared;
+
+static cs_shared *cs_sharedOf(const StringAction *action) {
+  cs_shared *shared;
+  
+  if (cssa_test((StringAction *)action, CSSA_SLICE | CSSA_MAPPED)) {
+    memcpy(&shared, action->buffer, sizeof(cs_shared *));
+    return shared;
+  }
+  
+  return (cs_shared *)(void *)action->string - 1;
+}
+
+// First byte of the block or mapping behind a header
+static const char *cs_sharedBytes(const cs_shared *shared) {
+  return shared->mapping ? shared->mapping : (const char *)shared;
+}
+
+// Drops one reference, releasing the block with the last one
+static void cs_releaseShared(cs_shared *shared) {
+  const cs_allocator *allocator = shared->allocator;
+  
+  if (__atomic_sub_fetch(&shared->refs, 1, __ATOMIC_ACQ_REL)) {
+    return;
+  }
+  
+  if (shared->mapping) {
+    munmap(shared->mapping, shared->size);
+    allocator->release(allocator->context, shared, sizeof(cs_shared));
+  }
+  else {
+    allocator->release(allocator->context, shared, shared->size);
+  }
+}
+
+// Code point index for long, non-inline strings: the byte offset of every
+// CS_UTF8_STRIDE-th code point, so a lookup walks at most one stride. It
+// is kept in the inline buffer (unused by such strings) after the slot a
+// slice uses for its block, and dropped on mutation or release.
+#define CS_UTF8_STRIDE 64
+#define CS_UTF8_INDEX_MIN 256   // shorter strings are simply rescanned
+#define CS_UTF8_SLOT sizeof(void *)
+
+// A slice's block and an index both fit, or CS_INLINE_SIZE was set too low
+typedef char cs_inlineHoldsSlots[
+  CS_INLINE_SIZE >= CS_UTF8_SLOT + sizeof(void *) ? 1 : -1
+];
+
+typedef struct cs_utf8Index {
+  size_t codePoints;    // code points in the string
+  size_t count;         // entries in offsets, 0 for pure ASCII
+  size_t offsets[];     // offsets[k] is the byte offset of k * STRIDE
+} cs_utf8Index;
+
+static cs_utf8Index *cs_utf8IndexOf(const StringAction *action) {
+  cs_utf8Index *index;
+  
+  if (!cssa_test((StringAction *)action, CSSA_INDEXED)) {
+    return 0L;
+  }
+  
+  memcpy(&index, action->buffer + CS_UTF8_SLOT, sizeof(cs_utf8Index *));
+  return index;
+}
+
+// Drops a cached code point index
+static void cs_utf8IndexRelease(StringAction *action) {
+  const cs_allocator *allocator = cs_allocatorOf(action);
+  cs_utf8Index *index = cs_utf8IndexOf(action);
+  
+  if (index) {
+    allocator->release(
+      allocator->context, 
+      index, 
+      sizeof(cs_utf8Index) + index->count * sizeof(size_t)
+    );
+    action->lastAction &= ~CSSA_INDEXED;
+  }
+}
+
+// Releases a buffer through the allocator it came from; inline strings
+// have nothing to give back
+static void cs_releaseBuffer(StringAction *action) {
+  const cs_allocator *allocator = cs_allocatorOf(action);
+  
+  cs_utf8IndexRelease(action);
+  if (action->string && cssa_test(action, CSSA_SHARED | CSSA_SLICE)) {
+    cs_releaseShared(cs_sharedOf(action));
+  }
+  else if (action->string && cssa_test(action, CSSA_MAPPED)) {
+    munmap(action->string, action->size);
+  }
+  else if (action->string && !cssa_test(action, CSSA_INLINE)) {
+    allocator->release(allocator->context, action->string, action->size);
+  }
+}
 
 void cs_heapAction(StringAction *sa, char *string) {
+  memset(sa, 0L, sizeof(StringAction));
   sa->string = string;
   sa->length = strlen(string);
   sa->size = (sa->length + 1) * sizeof(char);
   sa->lastAction = CSSA_HEAP | CSSA_NEW;
   sa->recalloced = FALSE;
   sa->reserved = 0L;
+  sa->allocator = &CS_HEAP_ALLOCATOR;
 }
 
 StringAction *cs_new(size_t size) {
@@ -25,7 +293,8 @@ StringAction *cs_new(size_t size) {
 }
 
 StringAction *cs_copy(const char *string) {
-  return cs_copyAndResize(string, strlen(string) + 1);
+  size_t length = strlen(string);
+  return cs_copyBytesUsing(0L, string, length, length + 1, 0L);
 }
 
 StringAction *cs_copyAndResize(const char *string, size_t maxSize) {
@@ -36,11 +305,54 @@ StringAction *cs_copyAndResizeWith(
   const char *string, 
   size_t maxSize, 
   StringAction *useAction
+) {
+  return cs_copyAndResizeUsing(0L, string, maxSize, useAction);
+}
+
+StringAction *cs_newUsing(const cs_allocator *allocator, size_t size) {
+  return cs_copyAndResizeUsing(allocator, 0L, size, 0L);
+}
+
+StringAction *cs_copyUsing(const cs_allocator *allocator, const char *string) {
+  size_t length = strlen(string);
+  return cs_copyBytesUsing(allocator, string, length, length + 1, 0L);
+}
+
+StringAction *cs_copyAndResizeUsing(
+  const cs_allocator *allocator,
+  const char *string,
+  size_t maxSize,
+  StringAction *useAction
+) {
+  return cs_copyBytesUsing(
+    allocator, 
+    string, 
+    string ? strlen(string) : 0, 
+    maxSize, 
+    useAction
+  );
+}
+
+// Shared constructor; `bytes` may be 0L for an empty string, and `length`
+// is trusted so views and StringActions convert without a rescan
+static StringAction *cs_copyBytesUsing(
+  const cs_allocator *allocator,
+  const char *bytes,
+  size_t length,
+  size_t maxSize,
+  StringAction *useAction
 ) {
   StringAction *result = 0L;
   
+  if (!allocator) {
+    allocator = cs_globalAllocator;
+  }
+  
   if (!useAction) {
-    result = (StringAction *)malloc(sizeof(StringAction));
+    result = (StringAction *)allocator->allocate(
+      allocator->context, 
+      sizeof(StringAction)
+    );
     if (!result) {
       return 0L;
     }
@@ -50,298 +362,5858 @@ StringAction *cs_copyAndResizeWith(
     result = useAction;
   }
   
-  result->size = maxSize * sizeof(char);
-  result->string = (char *)malloc(result->size);
+  // The capacity always has room for the copied string and its terminator
+  result->size = (maxSize > length ? maxSize : length + 1) * sizeof(char);
   result->length = 0;
-  result->lastAction = string ? CSSA_NEW : CSSA_FAILED;
-  result->recalloced = TRUE;
+  result->lastAction = bytes ? CSSA_NEW : CSSA_FAILED;
+  result->allocator = allocator;
+  result->reserved = 0L;
+  
+  // Short strings live in the inline buffer and need no second allocation
+  if (result->size <= CS_INLINE_SIZE) {
+    result->size = CS_INLINE_SIZE;
+    result->string = result->buffer;
+    result->lastAction |= CSSA_INLINE;
+    result->recalloced = FALSE;
+  }
+  else {
+    result->string = (char *)allocator->allocate(
+      allocator->context, 
+      result->size
+    );
+    result->lastAction |= cs_storageOf(allocator);
+    result->recalloced = TRUE;
+  }
   
-  memset(result->string, 0L, result->size);
+  if (!result->string) {
+    result->size = 0;
+    result->lastAction = CSSA_FAILED;
+    return result;
+  }
   
   if (cssa_testAndClear(result, CSSA_FAILED)) {
+    memset(result->string, 0L, result->size);
     return result;
   }
   
-  memset(result->string, 0L, maxSize * sizeof(char));
-  
-  if (string) {
-    strcpy(result->string, string);
-    result->length = strlen(string);
-  }
+  // Copy the bytes and zero only what lies past them
+  memcpy(result->string, bytes, length * sizeof(char));
+  memset(&result->string[length], 0L, result->size - length);
+  result->length = length;
   
   return result;  
 }
 
 void cs_free(StringAction *action) {
+  const cs_allocator *allocator = cs_allocatorOf(action);
+  
   // Free the string if allocated
-  if (action->string) {
-    free(action->string);
-  }
+  cs_releaseBuffer(action);
   
   // Null out the memory space of the action to be thorough 
   memset(action, 0L, sizeof(StringAction));
   
   // Finally free the ram used with the action
-  free(action);
+  allocator->release(allocator->context, action, sizeof(StringAction));
 }
 
-void cs_freeAndRenew(
-  StringAction *action, 
-  const char *string, 
-  size_t maxSize
-) {
-  size_t size = maxSize;
-
-  // Free the string if allocated
-  if (action->string) {
-    free(action->string);
+// Moves the buffer behind a shared header once, so that later copies only
+// bump the reference count. A mapping stays where it is; only a header
+// that unmaps it with the last reference is allocated.
+static BOOL cs_share(StringAction *action) {
+  const cs_allocator *allocator;
+  cs_shared *shared;
+  
+  if (cssa_test(action, CSSA_SHARED | CSSA_SLICE)) {
+    return TRUE;
   }
   
-  // Zero out the memory for this object
-  memset(action, 0L, sizeof(StringAction));
+  allocator = cs_allocatorOf(action);
+  if (cssa_test(action, CSSA_MAPPED)) {
+    shared = (cs_shared *)allocator->allocate(
+      allocator->context, 
+      sizeof(cs_shared)
+    );
+    if (!shared) {
+      return FALSE;
+    }
+    
+    shared->refs = 1;
+    shared->size = action->size;
+    shared->allocator = allocator;
+    shared->mapping = action->string;
+    memcpy(action->buffer, &shared, sizeof(cs_shared *));
+    action->lastAction |= CSSA_SHARED;
+    
+    return TRUE;
+  }
   
-  if (maxSize <= 0L) {
-    size = strlen(string);
+  shared = (cs_shared *)allocator->allocate(
+    allocator->context, 
+    sizeof(cs_shared) + action->size
+  );
+  if (!shared) {
+    return FALSE;
   }
   
-  cs_copyAndResizeWith(string, size, action);
-}
-
-void cssa_flags(StringAction *action, size_t flags) {
-  action->lastAction = 0;
-  action->lastAction |= flags;
-}
-
-void cssa_modFlags(StringAction *action, size_t flags) {
-  action->lastAction = 0;
-  action->lastAction |= flags;
-}
-
-BOOL cssa_test(StringAction *action, size_t flag) {
-  return action->lastAction & flag;
-}
-
-BOOL cssa_testAndClear(StringAction *action, size_t flag) {
-  BOOL result = action->lastAction & flag;
-  action->lastAction = 0L;
-  return result;
-}
-
-char cs_charAt(const char *string, size_t index) {
-  return (char)string[index];
-}
-
-int cs_charCodeAt(const char *string, size_t index) {
-  return (int)string[index];
-}
-
-BOOL cs_endsWith(const char *string, const char *ending) {
-  char *substr;
-  size_t lastEnd;
-  size_t lastStr;
-  BOOL result;
+  shared->refs = 1;
+  shared->size = sizeof(cs_shared) + action->size;
+  shared->allocator = allocator;
+  shared->mapping = 0L;
+  memcpy(shared + 1, action->string, (action->length + 1) * sizeof(char));
   
-  substr = strstr(string, ending);
-  lastEnd = strlen(ending) - 1;
-  lastStr = strlen(string) - 1; 
-  result = substr && substr[lastEnd] == string[lastStr]; 
+  cs_releaseBuffer(action);
+  action->string = (char *)(shared + 1);
+  action->lastAction &= ~CSSA_STORAGE;
+  action->lastAction |= CSSA_SHARED | cs_storageOf(allocator);
   
-  return result;
-}
-
-char *cs_concat(char *string, const char *extra) {
-  StringAction sa;
-  cs_heapAction(&sa, string);
-  cssa_concat(&sa, extra);
-  return sa.string;
+  return TRUE;
 }
 
-StringAction *cssa_concat(StringAction *action, const char *extra) {
-  char *string;
+// Gives a slice or a mapped file its own terminated copy of the bytes and
+// lets go of the block or mapping it pointed into
+static StringAction *cs_materialize(StringAction *action) {
+  const cs_allocator *allocator = cs_allocatorOf(action);
+  cs_shared *shared = cssa_test(action, CSSA_SHARED | CSSA_SLICE) 
+    ? cs_sharedOf(action) 
+    : 0L;
+  char *oldstr = action->string;
+  size_t oldSize = action->size;
+  size_t storage;
+  size_t size;
   char *newstr;
-  char *cattedOut;
   
-  string = action->string;
-  newstr = (char *)realloc(
-    string, 
-    (strlen(string) + strlen(extra)) * sizeof(char)
-  );
-  cattedOut = 0L;
+  if (action->length < CS_INLINE_SIZE) {
+    newstr = action->buffer;
+    size = CS_INLINE_SIZE;
+    storage = CSSA_INLINE;
+  }
+  else {
+    size = action->length + 1;
+    newstr = (char *)allocator->allocate(allocator->context, size);
+    if (!newstr) {
+      action->lastAction |= CSSA_FAILED;
+      return action;
+    }
+    storage = cs_storageOf(allocator);
+    action->recalloced = TRUE;
+  }
   
-  if (!newstr) {
-    fprintf(stderr, "Ignoring concat due to memory allocation failure\n");
-    action->lastAction |= CSSA_FAILED;
+  memcpy(newstr, action->string, action->length * sizeof(char));
+  newstr[action->length] = '\0';
+  if (shared) {
+    cs_releaseShared(shared);
   }
   else {
-    cattedOut = strcat(string, extra);
+    munmap(oldstr, oldSize);
   }
   
-  action->string = cattedOut;
-  action->length = strlen(cattedOut);
-  action->size = (action->length + 1) * sizeof(char);
-  action->lastAction |= CSSA_REALLOC;
-  action->recalloced = TRUE;
+  action->string = newstr;
+  action->size = size;
+  action->lastAction &= ~CSSA_STORAGE;
+  action->lastAction |= storage;
   
   return action;
 }
 
-BOOL cs_includes(const char *haystack, const char *needle) {
-  return strstr(haystack, needle) != NULL;
-}
-
-BOOL cs_includesAt(const char *haystack, const char *needle, size_t fromIndex) {
-  return strstr(&haystack[fromIndex], needle) != NULL;
-}
-
-size_t cs_indexOf(const char *haystack, const char *needle) {
-  size_t index;
-  char *idxString;
+StringAction *cssa_copy(StringAction *action) {
+  const cs_allocator *allocator;
+  StringAction *copy;
   
-  index = -1;
-  idxString = strstr(haystack, needle);
+  if (!action || !action->string) {
+    return 0L;
+  }
   
-  if (idxString) {
-    index = (size_t)idxString - (size_t)haystack;
-  }  
+  // Inline strings are cheaper to copy than to share
+  allocator = cs_allocatorOf(action);
+  if (cssa_test(action, CSSA_INLINE)) {
+    return cs_copyBytesUsing(
+      allocator, 
+      action->string, 
+      action->length, 
+      action->length + 1, 
+      0L
+    );
+  }
   
-  return index;
-}
-
-char *cs_padEnd(char *string, size_t length) {
-  return cs_padEndWith(string, length, CS_DEFAULT_PADSTRING);
-}
-
-char *cs_padEndWith(char *string, size_t length, const char *padString) {
-  StringAction sa;
-  cs_heapAction(&sa, string);
-  return cssa_padEndWith(&sa, length, padString);
+  if (!cs_share(action)) {
+    action->lastAction |= CSSA_FAILED;
+    return 0L;
+  }
+  
+  copy = (StringAction *)allocator->allocate(
+    allocator->context, 
+    sizeof(StringAction)
+  );
+  if (!copy) {
+    action->lastAction |= CSSA_FAILED;
+    return 0L;
+  }
+  
+  memcpy(copy, action, sizeof(StringAction));
+  copy->lastAction = CSSA_NEW | (action->lastAction & CSSA_STORAGE);
+  copy->recalloced = FALSE;
+  __atomic_add_fetch(&cs_sharedOf(action)->refs, 1, __ATOMIC_RELAXED);
+  
+  return copy;
 }
 
-char *cssa_padEndWith(
-  StringAction *action,
-  size_t length,
-  const char *padString
-) {
-  const char *padding;
-  size_t padLen;
-  size_t strLen;
-  size_t i;
+StringAction *cssa_makeWritable(StringAction *action) {
+  const cs_allocator *allocator;
+  cs_shared *shared;
+  char *newstr;
+  size_t size;
   
-  padding = padString ? padString : CS_DEFAULT_PADSTRING;
+  if (!action || !action->string) {
+    return action;
+  }
   
-  strLen = strlen(action->string);
-  padLen = strlen(padding);
+  // Every mutation passes through here, so cached hashes and code point
+  // indexes end here too
+  action->reserved = 0L;
+  cs_utf8IndexRelease(action);
   
-  if (strLen >= length) {
-    action->lastAction |= CSSA_SKIPPED;
-    return action->string;
+  if (cssa_test(action, CSSA_SLICE | CSSA_MAPPED)) {
+    return cs_materialize(action);
   }
   
-  cs_copyAndResizeWith(action->string, length, action);
-  if (cssa_testAndClear(action, CSSA_FAILED)) {
-    fprintf(stderr, "Could not allocate memory!");
-    return action->string;
+  if (!cssa_test(action, CSSA_SHARED)) {
+    return action;
   }
-
-  if (strcmp(padding, CS_DEFAULT_PADSTRING) == 0) {
-    sprintf(action->string, "%-*s", (int)length, action->string);
+  
+  shared = cs_sharedOf(action);
+  allocator = shared->allocator;
+  if (__atomic_load_n(&shared->refs, __ATOMIC_ACQUIRE) == 1) {
+    // Sole owner: slide the bytes over the header and keep the block; the
+    // header is overwritten, so its size is read first
+    size = shared->size;
+    newstr = (char *)shared;
+    memmove(newstr, action->string, (action->length + 1) * sizeof(char));
+    action->size = size;
   }
   else {
-    for (i = strLen; i < length; i += padLen) {
-      strcat(action->string, padding);
-      if ((i + padLen - 1) >= length) {
-        strncat(action->string, padding, length - i);
-      }
+    newstr = (char *)allocator->allocate(allocator->context, action->size);
+    if (!newstr) {
+      action->lastAction |= CSSA_FAILED;
+      return action;
     }
+    memcpy(newstr, action->string, (action->length + 1) * sizeof(char));
+    cs_releaseShared(shared);
+    action->recalloced = TRUE;
   }
   
-  return action->string;
-}
-
-char *cs_padStart(char *string, size_t length) {
-  return cs_padStartWith(string, length, CS_DEFAULT_PADSTRING);
-}
-
-char *cs_padStartWith(char *string, size_t length, const char *padString) {
-  StringAction sa;
-  cs_heapAction(&sa, string);
-  return cssa_padStartWith(&sa, length, padString);
+  action->string = newstr;
+  action->lastAction &= ~CSSA_SHARED;
+  
+  return action;
 }
 
-char *cssa_padStartWith(
-  StringAction *action,
-  size_t length,
-  const char *padString
-) {
+const char *cssa_cstr(StringAction *action) {
   if (!action) {
-    return NULL;
+    return 0L;
   }
   
-  if (!action->string) {
-    cssa_flags(action, CSSA_FAILED);
-    return NULL;
+  if (cssa_test(action, CSSA_SLICE)) {
+    cs_materialize(action);
   }
   
-  char *original;
-  const char *padding;
+  return cssa_test(action, CSSA_SLICE) ? 0L : action->string;
+}
+
+StringAction *cssa_substring(StringAction *action, size_t start, size_t end) {
+  const cs_allocator *allocator;
+  StringAction *slice;
+  cs_shared *shared;
+  size_t swap;
   
-  size_t strLen;   // String length
-  size_t padLen;   // Length of padding string
-  size_t diffLen;  // Length of difference between desired and original  
-  int i;           // Iterator index  
+  if (!action || !action->string) {
+    return 0L;
+  }
   
-  strLen = strlen(action->string);
-  diffLen = length - strLen;
+  // Arguments are clamped and swapped as in JavaScript's substring
+  start = start < action->length ? start : action->length;
+  end = end < action->length ? end : action->length;
+  if (start > end) {
+    swap = start;
+    start = end;
+    end = swap;
+  }
   
-  if (strLen >= length) {
-    action->lastAction |= CSSA_SKIPPED;
-    return action->string;
+  // Pieces that fit inline are cheaper to copy than to share
+  allocator = cs_allocatorOf(action);
+  if (end - start < CS_INLINE_SIZE || cssa_test(action, CSSA_INLINE)) {
+    return cs_copyBytesUsing(
+      allocator, 
+      action->string + start, 
+      end - start, 
+      end - start + 1, 
+      0L
+    );
   }
-
-  original = strdup(action->string);
-  padding = padString ? padString : CS_DEFAULT_PADSTRING;
-  padLen = strlen(padding);
   
-  cs_copyAndResizeWith(action->string, length, action);
-  if (cssa_testAndClear(action, CSSA_FAILED)) {
-    fprintf(stderr, "Could not allocate memory!");
-    return action->string;
+  if (!cs_share(action)) {
+    action->lastAction |= CSSA_FAILED;
+    return 0L;
   }
   
-  for (i = 0; i < diffLen; i++) {
-    action->string[i] = padding[i % padLen];
+  slice = (StringAction *)allocator->allocate(
+    allocator->context, 
+    sizeof(StringAction)
+  );
+  if (!slice) {
+    action->lastAction |= CSSA_FAILED;
+    return 0L;
   }
   
-  strcpy(&action->string[i], original);
+  shared = cs_sharedOf(action);
+  __atomic_add_fetch(&shared->refs, 1, __ATOMIC_RELAXED);
   
-  free(original);
+  memset(slice, 0L, sizeof(StringAction));
+  memcpy(slice->buffer, &shared, sizeof(cs_shared *));
+  slice->string = action->string + start;
+  slice->length = end - start;
+  slice->size = end - start;
+  slice->lastAction = CSSA_NEW | CSSA_SLICE | cs_storageOf(allocator);
+  slice->allocator = action->allocator;
   
-  return action->string;
-}
-
-char *cs_repeat(char *string, unsigned int times) {
-  StringAction sa; 
-  cs_heapAction(&sa, string);
-  return cssa_repeat(&sa, times);
+  return slice;
 }
 
-char *cssa_repeat(StringAction *action, unsigned int times) {
+void cs_freeAndRenew(
+  StringAction *action, 
+  const char *string, 
+  size_t maxSize
+) {
+  // Renewing keeps the action bound to the allocator it came from
+  cs_freeAndRenewUsing(action->allocator, action, string, maxSize);
+}
+
+void cs_freeAndRenewUsing(
+  const cs_allocator *allocator,
+  StringAction *action, 
+  const char *string, 
+  size_t maxSize
+) {
+  size_t size = maxSize;
+
+  // Free the string if allocated
+  cs_releaseBuffer(action);
+  
+  // Zero out the memory for this object
+  memset(action, 0L, sizeof(StringAction));
+  
+  if (maxSize <= 0L) {
+    size = strlen(string) + 1;
+  }
+  
+  cs_copyAndResizeUsing(allocator, string, size, action);
+}
+
+static void *cs_arena_allocate(void *context, size_t size) {
+  return cs_arena_alloc((cs_arena *)context, size);
+}
+
+static void *cs_arena_reallocate(
+  void *context, 
+  void *memory, 
+  size_t oldSize, 
+  size_t newSize
+) {
+  return cs_arena_grow((cs_arena *)context, memory, oldSize, newSize);
+}
+
+static void cs_arena_release(void *context, void *memory, size_t size) {
+  cs_arena *arena = (cs_arena *)context;
+  
+  // Only the latest allocation can be handed back before a reset
+  if (memory && (char *)memory == arena->last) {
+    arena->head->used = (size_t)(arena->last - arena->head->data);
+    arena->last = 0L;
+  }
+}
+
+cs_arena *cs_arena_create(size_t chunkSize) {
+  const cs_allocator *parent = cs_globalAllocator;
+  cs_arena *arena;
+  
+  arena = (cs_arena *)parent->allocate(parent->context, sizeof(cs_arena));
+  if (!arena) {
+    return 0L;
+  }
+  
+  memset(arena, 0L, sizeof(cs_arena));
+  arena->chunkSize = chunkSize ? chunkSize : CS_ARENA_CHUNK;
+  arena->parent = parent;
+  arena->allocator.allocate = cs_arena_allocate;
+  arena->allocator.reallocate = cs_arena_reallocate;
+  arena->allocator.release = cs_arena_release;
+  arena->allocator.context = arena;
+  
+  return arena;
+}
+
+const cs_allocator *cs_arena_allocator(cs_arena *arena) {
+  return arena ? &arena->allocator : cs_globalAllocator;
+}
+
+void cs_arena_reset(cs_arena *arena) {
+  cs_arenaChunk *chunk;
+  cs_arenaChunk *next;
+  
+  if (!arena || !arena->head) {
+    return;
+  }
+  
+  // Keep the current chunk around for the next request, drop the rest
+  chunk = arena->head->next;
+  while (chunk) {
+    next = chunk->next;
+    arena->reserved -= sizeof(cs_arenaChunk) + chunk->size;
+    arena->parent->release(
+      arena->parent->context, 
+      chunk, 
+      sizeof(cs_arenaChunk) + chunk->size
+    );
+    chunk = next;
+  }
+  
+  arena->head->next = 0L;
+  arena->head->used = 0;
+  arena->last = 0L;
+  arena->allocations = 0;
+}
+
+void cs_arena_destroy(cs_arena *arena) {
+  cs_arenaChunk *chunk;
+  cs_arenaChunk *next;
+  
+  if (!arena) {
+    return;
+  }
+  
+  chunk = arena->head;
+  while (chunk) {
+    next = chunk->next;
+    arena->parent->release(
+      arena->parent->context, 
+      chunk, 
+      sizeof(cs_arenaChunk) + chunk->size
+    );
+    chunk = next;
+  }
+  
+  arena->parent->release(arena->parent->context, arena, sizeof(cs_arena));
+}
+
+void cs_arena_stats(cs_arena *arena, cs_allocStats *stats) {
+  cs_arenaChunk *chunk;
+  
+  memset(stats, 0L, sizeof(cs_allocStats));
+  if (!arena) {
+    return;
+  }
+  
+  for (chunk = arena->head; chunk; chunk = chunk->next) {
+    stats->requested += chunk->used;
+  }
+  stats->reserved = arena->reserved;
+  stats->blocks = arena->allocations;
+  stats->peak = arena->peak;
+}
+
+// Offset within the head chunk at which the next allocation would start
+static size_t cs_arena_nextOffset(cs_arenaChunk *chunk) {
+  size_t address;
+  
+  address = (size_t)(chunk->data + chunk->used);
+  address = (address + CS_ARENA_ALIGN - 1) & ~(size_t)(CS_ARENA_ALIGN - 1);
+  
+  return address - (size_t)chunk->data;
+}
+
+void *cs_arena_alloc(cs_arena *arena, size_t size) {
+  cs_arenaChunk *chunk;
+  size_t offset;
+  size_t chunkSize;
+  
+  if (!arena) {
+    return 0L;
+  }
+  
+  chunk = arena->head;
+  offset = chunk ? cs_arena_nextOffset(chunk) : 0;
+  
+  if (!chunk || offset > chunk->size || chunk->size - offset < size) {
+    chunkSize = size + CS_ARENA_ALIGN > arena->chunkSize
+      ? size + CS_ARENA_ALIGN
+      : arena->chunkSize;
+    
+    chunk = (cs_arenaChunk *)arena->parent->allocate(
+      arena->parent->context,
+      sizeof(cs_arenaChunk) + chunkSize
+    );
+    if (!chunk) {
+      return 0L;
+    }
+    
+    chunk->next = arena->head;
+    chunk->size = chunkSize;
+    chunk->used = 0;
+    arena->head = chunk;
+    arena->reserved += sizeof(cs_arenaChunk) + chunkSize;
+    if (arena->reserved > arena->peak) {
+      arena->peak = arena->reserved;
+    }
+    offset = cs_arena_nextOffset(chunk);
+  }
+  
+  chunk->used = offset + size;
+  arena->last = chunk->data + offset;
+  arena->allocations++;
+  
+  return arena->last;
+}
+
+void *cs_arena_grow(
+  cs_arena *arena,
+  void *memory,
+  size_t oldSize,
+  size_t newSize
+) {
+  cs_arenaChunk *chunk;
+  char *grown;
+  size_t offset;
+  
+  if (!arena) {
+    return 0L;
+  }
+  
+  // The most recent allocation can simply move the end of its chunk
+  chunk = arena->head;
+  if (memory && (char *)memory == arena->last) {
+    offset = (size_t)((char *)memory - chunk->data);
+    if (chunk->size - offset >= newSize) {
+      chunk->used = offset + newSize;
+      return memory;
+    }
+  }
+  
+  grown = (char *)cs_arena_alloc(arena, newSize);
+  if (grown && memory) {
+    memcpy(grown, memory, oldSize < newSize ? oldSize : newSize);
+  }
+  
+  return grown;
+}
+
+BOOL cs_arena_owns(cs_arena *arena, const void *memory) {
+  cs_arenaChunk *chunk;
+  
+  if (!arena) {
+    return FALSE;
+  }
+  
+  for (chunk = arena->head; chunk; chunk = chunk->next) {
+    if (
+      (const char *)memory >= chunk->data && 
+      (const char *)memory < chunk->data + chunk->size
+    ) {
+      return TRUE;
+    }
+  }
+  
+  return FALSE;
+}
+
+StringAction *cs_arena_new(cs_arena *arena, size_t size) {
+  return cs_arena_copyAndResizeWith(arena, 0L, size, 0L);
+}
+
+StringAction *cs_arena_copy(cs_arena *arena, const char *string) {
+  size_t length = strlen(string);
+  return cs_copyBytesUsing(
+    cs_arena_allocator(arena), 
+    string, 
+    length, 
+    length + 1, 
+    0L
+  );
+}
+
+StringAction *cs_arena_copyAndResize(
+  cs_arena *arena,
+  const char *string,
+  size_t maxSize
+) {
+  return cs_arena_copyAndResizeWith(arena, string, maxSize, 0L);
+}
+
+StringAction *cs_arena_copyAndResizeWith(
+  cs_arena *arena,
+  const char *string,
+  size_t maxSize,
+  StringAction *useAction
+) {
+  return cs_copyAndResizeUsing(
+    cs_arena_allocator(arena), 
+    string, 
+    maxSize, 
+    useAction
+  );
+}
+
+void cs_arena_freeAndRenew(
+  cs_arena *arena,
+  StringAction *action, 
+  const char *string, 
+  size_t maxSize
+) {
+  cs_freeAndRenewUsing(cs_arena_allocator(arena), action, string, maxSize);
+}
+
+// Wraps a fresh arena buffer holding `string` so the cssa_ paths can fill it
+static char *cs_arena_wrap(
+  StringAction *sa,
+  cs_arena *arena,
+  const char *string,
+  size_t capacity
+) {
+  size_t length;
+  
+  length = strlen(string);
+  if (capacity < length + 1) {
+    capacity = length + 1;
+  }
+  
+  memset(sa, 0L, sizeof(StringAction));
+  sa->string = (char *)cs_arena_alloc(arena, capacity * sizeof(char));
+  if (!sa->string) {
+    return 0L;
+  }
+  
+  memcpy(sa->string, string, (length + 1) * sizeof(char));
+  sa->length = length;
+  sa->size = capacity;
+  sa->lastAction = CSSA_ARENA | CSSA_NEW;
+  sa->allocator = &arena->allocator;
+  
+  return sa->string;
+}
+
+char *cs_arena_padEndWith(
+  cs_arena *arena,
+  const char *string,
+  size_t length,
+  const char *padString
+) {
+  StringAction sa;
+  
+  if (!cs_arena_wrap(&sa, arena, string, length + 1)) {
+    return 0L;
+  }
+  
+  return cssa_padEndWith(&sa, length, padString);
+}
+
+char *cs_arena_padStartWith(
+  cs_arena *arena,
+  const char *string,
+  size_t length,
+  const char *padString
+) {
+  StringAction sa;
+  
+  if (!cs_arena_wrap(&sa, arena, string, length + 1)) {
+    return 0L;
+  }
+  
+  return cssa_padStartWith(&sa, length, padString);
+}
+
+char *cs_arena_repeat(
+  cs_arena *arena,
+  const char *string,
+  unsigned int times
+) {
   char *buffer;
-  int i;
+  size_t length;
+  
+  length = strlen(string);
+  if (times && length > ((size_t)-1 - 1) / times) {
+    return 0L;
+  }
+  
+  buffer = (char *)cs_arena_alloc(arena, (length * times + 1) * sizeof(char));
+  if (!buffer) {
+    return 0L;
+  }
+  
+  cs_repeatInto(string, length, times, buffer, length * times + 1);
+  
+  return buffer;
+}
+
+// Index of the highest set bit; value must be non-zero
+static unsigned int cs_highBit(size_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+  return (unsigned int)(sizeof(unsigned long long) * 8 - 1) - 
+    (unsigned int)__builtin_clzll((unsigned long long)value);
+#else
+  unsigned int bit = 0;
+  while (value >>= 1) {
+    bit++;
+  }
+  return bit;
+#endif
+}
+
+// Size classes run 16, 24, 32, 48, 64, 96 ... 4096 so that no block wastes
+// more than a third of itself
+static unsigned int cs_pool_classOf(size_t size) {
+  size_t n;
+  unsigned int bit;
+  
+  if (size <= CS_POOL_MIN) {
+    return 0;
+  }
+  
+  n = size - 1;
+  bit = cs_highBit(n);
+  
+  return 1 + 2 * (bit - 4) + (unsigned int)((n >> (bit - 1)) & 1);
+}
+
+static size_t cs_pool_classSize(unsigned int sizeClass) {
+  unsigned int bit;
+  
+  if (sizeClass == 0) {
+    return CS_POOL_MIN;
+  }
+  
+  bit = 4 + (sizeClass - 1) / 2;
+  return (sizeClass - 1) % 2 ? (size_t)2 << bit : (size_t)3 << (bit - 1);
+}
+
+static void cs_pool_reserved(cs_pool *pool, size_t bytes) {
+  pool->stats.reserved += bytes;
+  if (pool->stats.reserved > pool->stats.peak) {
+    pool->stats.peak = pool->stats.reserved;
+  }
+}
+
+static void *cs_pool_allocate(void *context, size_t size) {
+  cs_pool *pool = (cs_pool *)context;
+  cs_poolSlab *slab;
+  unsigned int sizeClass;
+  size_t classSize;
+  void *block;
+  
+  if (size > CS_POOL_MAX) {
+    block = pool->parent->allocate(pool->parent->context, size);
+    if (block) {
+      cs_pool_reserved(pool, size);
+      pool->stats.requested += size;
+      pool->stats.blocks++;
+    }
+    return block;
+  }
+  
+  sizeClass = cs_pool_classOf(size);
+  classSize = cs_pool_classSize(sizeClass);
+  block = pool->freeLists[sizeClass];
+  
+  if (block) {
+    pool->freeLists[sizeClass] = *(void **)block;
+  }
+  else {
+    // Carve the block out of the newest slab, starting a new one if needed
+    if (!pool->cursor || (size_t)(pool->limit - pool->cursor) < classSize) {
+      slab = (cs_poolSlab *)pool->parent->allocate(
+        pool->parent->context,
+        sizeof(cs_poolSlab) + CS_POOL_SLAB
+      );
+      if (!slab) {
+        return 0L;
+      }
+      
+      slab->next = pool->slabs;
+      pool->slabs = slab;
+      pool->cursor = (char *)(slab + 1);
+      pool->limit = pool->cursor + CS_POOL_SLAB;
+      cs_pool_reserved(pool, sizeof(cs_poolSlab) + CS_POOL_SLAB);
+    }
+    
+    block = pool->cursor;
+    pool->cursor += classSize;
+  }
+  
+  pool->stats.requested += size;
+  pool->stats.blocks++;
+  
+  return block;
+}
+
+static void cs_pool_release(void *context, void *memory, size_t size) {
+  cs_pool *pool = (cs_pool *)context;
+  unsigned int sizeClass;
+  
+  if (!memory) {
+    return;
+  }
+  
+  pool->stats.requested -= size;
+  pool->stats.blocks--;
+  
+  if (size > CS_POOL_MAX) {
+    pool->parent->release(pool->parent->context, memory, size);
+    pool->stats.reserved -= size;
+    return;
+  }
+  
+  sizeClass = cs_pool_classOf(size);
+  *(void **)memory = pool->freeLists[sizeClass];
+  pool->freeLists[sizeClass] = memory;
+}
+
+static void *cs_pool_reallocate(
+  void *context, 
+  void *memory, 
+  size_t oldSize, 
+  size_t newSize
+) {
+  cs_pool *pool = (cs_pool *)context;
+  void *grown;
+  
+  if (!memory) {
+    return cs_pool_allocate(context, newSize);
+  }
+  
+  // Staying within one size class needs no copy at all
+  if (
+    oldSize <= CS_POOL_MAX && 
+    newSize <= CS_POOL_MAX &&
+    cs_pool_classOf(oldSize) == cs_pool_classOf(newSize)
+  ) {
+    pool->stats.requested += newSize;
+    pool->stats.requested -= oldSize;
+    return memory;
+  }
+  
+  grown = cs_pool_allocate(context, newSize);
+  if (grown) {
+    memcpy(grown, memory, oldSize < newSize ? oldSize : newSize);
+    cs_pool_release(context, memory, oldSize);
+  }
+  
+  return grown;
+}
+
+cs_pool *cs_pool_create(const cs_allocator *parent) {
+  cs_pool *pool;
+  
+  if (!parent) {
+    parent = cs_globalAllocator;
+  }
+  
+  pool = (cs_pool *)parent->allocate(parent->context, sizeof(cs_pool));
+  if (!pool) {
+    return 0L;
+  }
+  
+  memset(pool, 0L, sizeof(cs_pool));
+  pool->parent = parent;
+  pool->allocator.allocate = cs_pool_allocate;
+  pool->allocator.reallocate = cs_pool_reallocate;
+  pool->allocator.release = cs_pool_release;
+  pool->allocator.context = pool;
+  
+  return pool;
+}
+
+void cs_pool_destroy(cs_pool *pool) {
+  cs_poolSlab *slab;
+  cs_poolSlab *next;
+  
+  if (!pool) {
+    return;
+  }
+  
+  slab = pool->slabs;
+  while (slab) {
+    next = slab->next;
+    pool->parent->release(
+      pool->parent->context, 
+      slab, 
+      sizeof(cs_poolSlab) + CS_POOL_SLAB
+    );
+    slab = next;
+  }
+  
+  pool->parent->release(pool->parent->context, pool, sizeof(cs_pool));
+}
+
+const cs_allocator *cs_pool_allocator(cs_pool *pool) {
+  return pool ? &pool->allocator : cs_globalAllocator;
+}
+
+void cs_pool_stats(cs_pool *pool, cs_allocStats *stats) {
+  if (pool) {
+    *stats = pool->stats;
+  }
+  else {
+    memset(stats, 0L, sizeof(cs_allocStats));
+  }
+}
+
+void cssa_flags(StringAction *action, size_t flags) {
+  action->lastAction &= CS_PERSISTENT;
+  action->lastAction |= flags;
+}
+
+void cssa_modFlags(StringAction *action, size_t flags) {
+  action->lastAction &= CS_PERSISTENT;
+  action->lastAction |= flags;
+}
+
+BOOL cssa_test(StringAction *action, size_t flag) {
+  return (action->lastAction & flag) != 0;
+}
+
+BOOL cssa_testAndClear(StringAction *action, size_t flag) {
+  BOOL result = (action->lastAction & flag) != 0;
+  action->lastAction &= CS_PERSISTENT;
+  return result;
+}
+
+char cs_charAt(const char *string, size_t index) {
+  return (char)string[index];
+}
+
+int cs_charCodeAt(const char *string, size_t index) {
+  return (int)string[index];
+}
+
+BOOL cs_endsWith(const char *string, const char *ending) {
+  size_t lengthEnd;
+  size_t lengthStr;
+  
+  lengthEnd = strlen(ending);
+  lengthStr = strlen(string);
+  
+  return lengthEnd <= lengthStr && 
+    memcmp(&string[lengthStr - lengthEnd], ending, lengthEnd) == 0;
+}
+
+char *cs_concat(char *string, const char *extra) {
+  StringAction sa;
+  cs_heapAction(&sa, string);
+  cssa_concat(&sa, extra);
+  return sa.string;
+}
+
+StringAction *cssa_concat(StringAction *action, const char *extra) {
+  if (!action || !extra) {
+    return action;
+  }
+  
+  return cssa_append(action, extra, strlen(extra));
+}
+
+// TRUE when [ptr, ptr + len) lies within the `length` bytes at `start`
+static BOOL cs_within(
+  const char *start,
+  size_t length,
+  const char *ptr,
+  size_t len
+) {
+  return start 
+    && ptr >= start 
+    && len <= length 
+    && (size_t)(ptr - start) <= length - len;
+}
+
+// Takes a reference on the shared block behind `action` when one of the
+// views reads it outside the action's own bytes. Those bytes are not
+// carried over when a mutation copies the action out of the block, which
+// it may then release while the views are still to be read.
+static cs_shared *cs_pinBlock(
+  StringAction *action,
+  const cs_view *views,
+  size_t count
+) {
+  const char *block;
+  cs_shared *shared;
+  size_t i;
+  
+  if (!action->string || !cssa_test(action, CSSA_SHARED | CSSA_SLICE)) {
+    return 0L;
+  }
+  
+  shared = cs_sharedOf(action);
+  block = cs_sharedBytes(shared);
+  for (i = 0; i < count; i++) {
+    if (
+      views[i].len &&
+      views[i].ptr >= block && 
+      views[i].ptr < block + shared->size &&
+      !cs_within(action->string, action->length, views[i].ptr, views[i].len)
+    ) {
+      __atomic_add_fetch(&shared->refs, 1, __ATOMIC_RELAXED);
+      return shared;
+    }
+  }
+  
+  return 0L;
+}
+
+// Reserves capacity and reports whether it is really there; FAILED is
+// sticky in lastAction so it cannot tell a new failure from an old one
+static BOOL cs_grow(StringAction *action, size_t capacity) {
+  cssa_reserve(action, capacity);
+  
+  return action->string 
+    && action->size >= capacity 
+    && !cssa_test(action, CS_READONLY);
+}
+
+StringAction *cssa_append(
+  StringAction *action,
+  const char *bytes,
+  size_t length
+) {
+  cs_shared *pinned;
+  cs_view piece;
+  size_t offset;
+  BOOL aliased;
+  
+  if (!action || !bytes) {
+    return action;
+  }
+  
+  // Appending a piece of ourselves must survive the buffer moving
+  aliased = cs_within(action->string, action->length, bytes, length);
+  offset = aliased ? (size_t)(bytes - action->string) : 0;
+  
+  piece = cs_viewOfBytes(bytes, length);
+  pinned = cs_pinBlock(action, &piece, 1);
+  
+  if (cs_grow(action, action->length + length + 1)) {
+    if (aliased) {
+      bytes = action->string + offset;
+    }
+    
+    memmove(&action->string[action->length], bytes, length * sizeof(char));
+    action->length += length;
+    action->string[action->length] = '\0';
+    action->lastAction |= CSSA_CONCAT;
+  }
+  else {
+    fprintf(stderr, "Ignoring concat due to memory allocation failure\n");
+  }
+  
+  if (pinned) {
+    cs_releaseShared(pinned);
+  }
+  
+  return action;
+}
+
+// Pieces joined on the stack before the view list spills to the allocator
+#define CS_JOIN_STACK 64
+
+// Total length of the pieces plus separators, or CS_NOT_FOUND on overflow
+static size_t cs_joinedLength(
+  const cs_view *parts,
+  size_t count,
+  cs_view separator
+) {
+  size_t total = 0;
+  size_t i;
+  
+  for (i = 0; i < count; i++) {
+    if (parts[i].len > (size_t)-1 - 1 - total) {
+      return CS_NOT_FOUND;
+    }
+    total += parts[i].len;
+    
+    if (i && separator.len) {
+      if (separator.len > (size_t)-1 - 1 - total) {
+        return CS_NOT_FOUND;
+      }
+      total += separator.len;
+    }
+  }
+  
+  return total;
+}
+
+// Copies the pieces out with memcpy. Pieces lying wholly within a buffer
+// which has since moved, [oldBase, oldBase + span), are read from newBase.
+static char *cs_writeJoined(
+  char *out,
+  const cs_view *parts,
+  size_t count,
+  cs_view separator,
+  uintptr_t oldBase,
+  size_t span,
+  const char *newBase
+) {
+  const char *ptr;
+  size_t i;
+  
+  if (cs_within((const char *)oldBase, span, separator.ptr, separator.len)) {
+    separator.ptr = newBase + ((uintptr_t)separator.ptr - oldBase);
+  }
+  
+  for (i = 0; i < count; i++) {
+    if (i && separator.len) {
+      memcpy(out, separator.ptr, separator.len);
+      out += separator.len;
+    }
+    
+    ptr = parts[i].ptr;
+    if (cs_within((const char *)oldBase, span, ptr, parts[i].len)) {
+      ptr = newBase + ((uintptr_t)ptr - oldBase);
+    }
+    if (parts[i].len) {
+      memcpy(out, ptr, parts[i].len);
+      out += parts[i].len;
+    }
+  }
+  
+  return out;
+}
+
+// Measures every piece once, grows at most once and copies each piece
+static StringAction *cs_appendJoined(
+  StringAction *action,
+  const cs_view *parts,
+  size_t count,
+  cs_view separator
+) {
+  cs_shared *pinned;
+  uintptr_t oldBase;
+  size_t span;
+  size_t total;
+  char *end;
+  
+  total = cs_joinedLength(parts, count, separator);
+  if (total == CS_NOT_FOUND || total > (size_t)-1 - 1 - action->length) {
+    action->lastAction |= CSSA_FAILED;
+    return action;
+  }
+  
+  oldBase = (uintptr_t)action->string;
+  span = action->string ? action->length : 0;
+  
+  pinned = cs_pinBlock(action, parts, count);
+  if (!pinned) {
+    pinned = cs_pinBlock(action, &separator, 1);
+  }
+  
+  if (cs_grow(action, action->length + total + 1)) {
+    end = cs_writeJoined(
+      &action->string[action->length],
+      parts,
+      count,
+      separator,
+      oldBase,
+      (uintptr_t)action->string == oldBase ? 0 : span,
+      action->string
+    );
+    action->length = (size_t)(end - action->string);
+    action->string[action->length] = '\0';
+    action->lastAction |= CSSA_CONCAT;
+  }
+  else {
+    fprintf(stderr, "Ignoring concat due to memory allocation failure\n");
+  }
+  
+  if (pinned) {
+    cs_releaseShared(pinned);
+  }
+  
+  return action;
+}
+
+// Runs `join` over views of C strings, measuring each exactly once; the
+// view list lives on the stack unless there are many pieces
+static StringAction *cs_appendStrings(
+  StringAction *action,
+  const char **parts,
+  size_t count,
+  const char *separator
+) {
+  const cs_allocator *allocator;
+  cs_view stack[CS_JOIN_STACK];
+  cs_view *views;
+  size_t i;
+  
+  views = stack;
+  allocator = cs_allocatorOf(action);
+  if (count > CS_JOIN_STACK) {
+    if (count > ((size_t)-1) / sizeof(cs_view)) {
+      action->lastAction |= CSSA_FAILED;
+      return action;
+    }
+    views = (cs_view *)allocator->allocate(
+      allocator->context, 
+      count * sizeof(cs_view)
+    );
+    if (!views) {
+      action->lastAction |= CSSA_FAILED;
+      return action;
+    }
+  }
+  
+  for (i = 0; i < count; i++) {
+    views[i] = cs_viewOf(parts[i] ? parts[i] : CS_EMPTY_STRING);
+  }
+  
+  cs_appendJoined(
+    action, 
+    views, 
+    count, 
+    cs_viewOf(separator ? separator : CS_EMPTY_STRING)
+  );
+  
+  if (views != stack) {
+    allocator->release(allocator->context, views, count * sizeof(cs_view));
+  }
+  
+  return action;
+}
+
+StringAction *cssa_concatMany(
+  StringAction *action,
+  const char **parts,
+  size_t count
+) {
+  if (!action || !parts) {
+    return action;
+  }
+  
+  return cs_appendStrings(action, parts, count, 0L);
+}
+
+char *cs_join(const char **parts, size_t count, const char *separator) {
+  StringAction sa;
+  
+  // Start without a buffer; the one allocation happens in cssa_reserve
+  memset(&sa, 0L, sizeof(StringAction));
+  sa.lastAction = CSSA_HEAP | CSSA_NEW;
+  sa.allocator = &CS_HEAP_ALLOCATOR;
+  
+  if (!parts) {
+    count = 0;
+  }
+  
+  cs_appendStrings(
+    &sa, 
+    parts, 
+    count, 
+    separator ? separator : CS_DEFAULT_SEPARATOR
+  );
+  if (cssa_test(&sa, CSSA_FAILED)) {
+    cs_releaseBuffer(&sa);
+    return 0L;
+  }
+  
+  return sa.string;
+}
+
+StringAction *cssa_reserve(StringAction *action, size_t capacity) {
+  const cs_allocator *allocator;
+  size_t grown;
+  char *newstr;
+  
+  if (!action) {
+    return 0L;
+  }
+  
+  // Shared buffers are split before anything is written to them
+  if (cssa_test(cssa_makeWritable(action), CS_READONLY)) {
+    return action;
+  }
+  
+  if (action->string && action->size >= capacity) {
+    return action;
+  }
+  
+  // Grow geometrically so that N appends cost O(N) amortized
+  grown = action->size ? action->size : CS_MIN_CAPACITY;
+  while (grown < capacity) {
+    if (grown > ((size_t)-1) / 2) {
+      grown = capacity;
+      break;
+    }
+    grown *= 2;
+  }
+  
+  allocator = cs_allocatorOf(action);
+  if (cssa_test(action, CSSA_INLINE)) {
+    // Promote the inline buffer to the allocator's storage
+    newstr = (char *)allocator->allocate(
+      allocator->context, 
+      grown * sizeof(char)
+    );
+    if (newstr) {
+      memcpy(newstr, action->string, (action->length + 1) * sizeof(char));
+    }
+  }
+  else {
+    // Arena buffers extend in place while they are the latest allocation
+    newstr = (char *)allocator->reallocate(
+      allocator->context,
+      action->string, 
+      action->string ? action->size : 0,
+      grown * sizeof(char)
+    );
+  }
+  
+  if (!newstr) {
+    action->lastAction |= CSSA_FAILED;
+    return action;
+  }
+  
+  if (!action->string) {
+    newstr[0] = '\0';
+    action->length = 0;
+  }
+  
+  action->string = newstr;
+  action->size = grown;
+  action->lastAction &= ~CSSA_INLINE;
+  action->lastAction |= CSSA_REALLOC | cs_storageOf(allocator);
+  action->recalloced = TRUE;
+  
+  return action;
+}
+
+StringAction *cssa_shrinkToFit(StringAction *action) {
+  const cs_allocator *allocator;
+  char *newstr;
+  
+  if (
+    !action || 
+    !action->string || 
+    cssa_test(action, CSSA_INLINE) ||
+    cssa_test(action, CS_READONLY) ||
+    action->size <= action->length + 1
+  ) {
+    return action;
+  }
+  
+  allocator = cs_allocatorOf(action);
+  newstr = (char *)allocator->reallocate(
+    allocator->context,
+    action->string, 
+    action->size,
+    (action->length + 1) * sizeof(char)
+  );
+  if (!newstr) {
+    action->lastAction |= CSSA_FAILED;
+    return action;
+  }
+  
+  action->string = newstr;
+  action->size = action->length + 1;
+  action->lastAction |= CSSA_REALLOC;
+  action->recalloced = TRUE;
+  
+  return action;
+}
+
+StringAction *cssa_sync(StringAction *action) {
+  // Slices are not terminated; their length is authoritative
+  if (action && action->string && !cssa_test(action, CSSA_SLICE)) {
+    action->reserved = 0L;
+    cs_utf8IndexRelease(action);
+    action->length = strnlen(action->string, action->size);
+  }
+  
+  return action;
+}
+
+// Largest run copied per step once the pattern has been doubled up; the
+// source stays cache resident so big fills are bound by write bandwidth
+#define CS_FILL_BLOCK 65536
+
+void cs_fill(
+  char *dest,
+  size_t count,
+  const char *pattern,
+  size_t patternLength
+) {
+  size_t filled;
+  size_t block;
+  size_t chunk;
+  
+  if (!count || !patternLength) {
+    return;
+  }
+  
+  if (patternLength == 1) {
+    memset(dest, pattern[0], count);
+    return;
+  }
+  
+  // Seed one copy, then keep doubling what is already written
+  filled = patternLength < count ? patternLength : count;
+  memcpy(dest, pattern, filled);
+  
+  block = CS_FILL_BLOCK - CS_FILL_BLOCK % patternLength;
+  if (block < patternLength) {
+    block = patternLength;
+  }
+  
+  while (filled < count) {
+    chunk = filled < block ? filled : block;
+    if (chunk > count - filled) {
+      chunk = count - filled;
+    }
+    memcpy(dest + filled, dest, chunk);
+    filled += chunk;
+  }
+}
+
+size_t cs_repeatInto(
+  const char *string,
+  size_t length,
+  unsigned int times,
+  char *buffer,
+  size_t capacity
+) {
+  size_t total;
+  
+  if (times && length > ((size_t)-1 - 1) / times) {
+    return CS_NOT_FOUND;
+  }
+  
+  total = length * times;
+  if (!buffer || capacity < total + 1) {
+    return CS_NOT_FOUND;
+  }
+  
+  cs_fill(buffer, total, string, length);
+  buffer[total] = '\0';
+  
+  return total;
+}
+
+BOOL cs_includes(const char *haystack, const char *needle) {
+  return cs_indexOf(haystack, needle) != CS_NOT_FOUND;
+}
+
+BOOL cs_includesAt(const char *haystack, const char *needle, size_t fromIndex) {
+  size_t length;
+  
+  length = strlen(haystack);
+  if (fromIndex > length) {
+    fromIndex = length;
+  }
+  
+  return cs_search(
+    &haystack[fromIndex], 
+    length - fromIndex, 
+    needle, 
+    strlen(needle)
+  ) != CS_NOT_FOUND;
+}
+
+size_t cs_indexOf(const char *haystack, const char *needle) {
+  return cs_search(haystack, strlen(haystack), needle, strlen(needle));
+}
+
+size_t cs_lastIndexOf(const char *haystack, const char *needle) {
+  return cs_searchLast(haystack, strlen(haystack), needle, strlen(needle));
+}
+
+size_t cs_lastIndexOfFrom(
+  const char *haystack, 
+  const char *needle, 
+  size_t fromIndex
+) {
+  size_t needleLength;
+  size_t haystackLength;
+  
+  // Only the prefix a match starting at fromIndex could reach is measured
+  needleLength = strlen(needle);
+  if (fromIndex > ((size_t)-1 >> 1) - needleLength) {
+    haystackLength = strlen(haystack);
+  }
+  else {
+    haystackLength = strnlen(haystack, fromIndex + needleLength);
+  }
+  
+  return cs_searchLast(haystack, haystackLength, needle, needleLength);
+}
+
+// Finds the critical factorization of the needle for the Two-Way search,
+// returning the split point and storing the local period
+static size_t cs_criticalFactorization(
+  const unsigned char *needle,
+  size_t needleLength,
+  size_t *period
+) {
+  size_t maxSuffix, maxSuffixRev;
+  size_t j, k, p;
+  unsigned char a, b;
+  
+  // Maximal suffix under the normal byte ordering
+  maxSuffix = (size_t)-1;
+  j = 0;
+  k = p = 1;
+  while (j + k < needleLength) {
+    a = needle[j + k];
+    b = needle[maxSuffix + k];
+    if (a < b) {
+      j += k;
+      k = 1;
+      p = j - maxSuffix;
+    }
+    else if (a == b) {
+      if (k != p) {
+        ++k;
+      }
+      else {
+        j += p;
+        k = 1;
+      }
+    }
+    else {
+      maxSuffix = j++;
+      k = p = 1;
+    }
+  }
+  *period = p;
+  
+  // Maximal suffix under the reversed ordering
+  maxSuffixRev = (size_t)-1;
+  j = 0;
+  k = p = 1;
+  while (j + k < needleLength) {
+    a = needle[j + k];
+    b = needle[maxSuffixRev + k];
+    if (b < a) {
+      j += k;
+      k = 1;
+      p = j - maxSuffixRev;
+    }
+    else if (a == b) {
+      if (k != p) {
+        ++k;
+      }
+      else {
+        j += p;
+        k = 1;
+      }
+    }
+    else {
+      maxSuffixRev = j++;
+      k = p = 1;
+    }
+  }
+  
+  // The larger of the two suffixes gives the critical factorization
+  if (maxSuffixRev + 1 < maxSuffix + 1) {
+    return maxSuffix + 1;
+  }
+  *period = p;
+  return maxSuffixRev + 1;
+}
+
+static void cs_twoWay_prepare(
+  cs_twoWay *tw, 
+  const char *needle, 
+  size_t needleLength
+) {
+  const unsigned char *n = (const unsigned char *)needle;
+  size_t i;
+  
+  tw->suffix = cs_criticalFactorization(n, needleLength, &tw->period);
+  tw->periodic = memcmp(n, n + tw->period, tw->suffix) == 0;
+  if (!tw->periodic) {
+    tw->period = (tw->suffix > needleLength - tw->suffix 
+      ? tw->suffix 
+      : needleLength - tw->suffix) + 1;
+  }
+  
+  // Horspool style skip on the byte under the needle's last position
+  for (i = 0; i < 256; i++) {
+    tw->shift[i] = needleLength;
+  }
+  for (i = 0; i < needleLength; i++) {
+    tw->shift[n[i]] = needleLength - i - 1;
+  }
+}
+
+static size_t cs_twoWay_search(
+  const cs_twoWay *tw,
+  const char *haystack,
+  size_t haystackLength,
+  const char *needle,
+  size_t needleLength
+) {
+  const unsigned char *h = (const unsigned char *)haystack;
+  const unsigned char *n = (const unsigned char *)needle;
+  size_t suffix = tw->suffix;
+  size_t period = tw->period;
+  size_t memory = 0;
+  size_t shift;
+  size_t i, j;
+  
+  j = 0;
+  while (j + needleLength <= haystackLength) {
+    // Check the last byte first and skip past any window it rules out
+    shift = tw->shift[h[j + needleLength - 1]];
+    if (shift) {
+      // A periodic needle whose last period was out of place cannot match
+      // again until past the mismatch
+      if (tw->periodic && memory && shift < period) {
+        shift = needleLength - period;
+      }
+      memory = 0;
+      j += shift;
+      continue;
+    }
+    
+    // Scan the right half; the last byte has already matched
+    i = suffix > memory ? suffix : memory;
+    while (i < needleLength - 1 && n[i] == h[i + j]) {
+      ++i;
+    }
+    
+    if (needleLength - 1 <= i) {
+      // Scan the left half, stopping where a previous period left off
+      i = suffix - 1;
+      while (memory < i + 1 && n[i] == h[i + j]) {
+        --i;
+      }
+      if (i + 1 < memory + 1) {
+        return j;
+      }
+      
+      j += period;
+      memory = tw->periodic ? needleLength - period : 0;
+    }
+    else {
+      j += i - suffix + 1;
+      memory = 0;
+    }
+  }
+  
+  return CS_NOT_FOUND;
+}
+
+// Needle bytes checked against every window before a full comparison; the
+// plain search uses the first and last bytes, compiled patterns the rarest
+typedef struct cs_filter {
+  size_t offset1;       // earlier of the two needle positions
+  size_t offset2;       // later of the two needle positions
+  char byte1;           // needle[offset1]
+  char byte2;           // needle[offset2]
+} cs_filter;
+
+// Scalar filter; memchr on the first probe byte does the heavy lifting
+static size_t cs_search_scalar(
+  const char *haystack,
+  size_t haystackLength,
+  const char *needle,
+  size_t needleLength,
+  const cs_filter *filter
+) {
+  const char *cursor = haystack + filter->offset1;
+  const char *last = haystack + haystackLength - needleLength + filter->offset1;
+  const char *hit;
+  
+  while (cursor <= last) {
+    hit = (const char *)memchr(
+      cursor, 
+      filter->byte1, 
+      (size_t)(last - cursor) + 1
+    );
+    if (!hit) {
+      break;
+    }
+    
+    hit -= filter->offset1;
+    if (
+      hit[filter->offset2] == filter->byte2 &&
+      memcmp(hit, needle, needleLength) == 0
+    ) {
+      return (size_t)(hit - haystack);
+    }
+    cursor = hit + filter->offset1 + 1;
+  }
+  
+  return CS_NOT_FOUND;
+}
+
+#if CS_X86_SIMD
+// Compares 16 windows at a time: a window is a candidate when both of its
+// probe bytes match those of the needle
+static size_t cs_search_sse2(
+  const char *haystack,
+  size_t haystackLength,
+  const char *needle,
+  size_t needleLength,
+  const cs_filter *filter
+) {
+  const __m128i probe1 = _mm_set1_epi8(filter->byte1);
+  const __m128i probe2 = _mm_set1_epi8(filter->byte2);
+  size_t i = 0;
+  size_t rest;
+  unsigned int mask;
+  unsigned int bit;
+  
+  for (; i + needleLength - 1 + 16 <= haystackLength; i += 16) {
+    const char *block = haystack + i;
+    
+    mask = (unsigned int)_mm_movemask_epi8(_mm_and_si128(
+      _mm_cmpeq_epi8(probe1, _mm_loadu_si128(
+        (const __m128i *)(block + filter->offset1)
+      )),
+      _mm_cmpeq_epi8(probe2, _mm_loadu_si128(
+        (const __m128i *)(block + filter->offset2)
+      ))
+    ));
+    
+    while (mask) {
+      bit = (unsigned int)__builtin_ctz(mask);
+      if (memcmp(block + bit, needle, needleLength) == 0) {
+        return i + bit;
+      }
+      mask &= mask - 1;
+    }
+  }
+  
+  rest = cs_search_scalar(
+    haystack + i, 
+    haystackLength - i, 
+    needle, 
+    needleLength,
+    filter
+  );
+  return rest == CS_NOT_FOUND ? rest : i + rest;
+}
+
+__attribute__((target("avx2")))
+static size_t cs_search_avx2(
+  const char *haystack,
+  size_t haystackLength,
+  const char *needle,
+  size_t needleLength,
+  const cs_filter *filter
+) {
+  const __m256i probe1 = _mm256_set1_epi8(filter->byte1);
+  const __m256i probe2 = _mm256_set1_epi8(filter->byte2);
+  size_t i = 0;
+  size_t rest;
+  unsigned long long mask;
+  unsigned int bit;
+  
+  // Two vectors per iteration keep both load ports busy
+  for (; i + needleLength - 1 + 64 <= haystackLength; i += 64) {
+    const char *block1 = haystack + i + filter->offset1;
+    const char *block2 = haystack + i + filter->offset2;
+    __m256i eq0 = _mm256_and_si256(
+      _mm256_cmpeq_epi8(probe1, _mm256_loadu_si256((const __m256i *)block1)),
+      _mm256_cmpeq_epi8(probe2, _mm256_loadu_si256((const __m256i *)block2))
+    );
+    __m256i eq1 = _mm256_and_si256(
+      _mm256_cmpeq_epi8(probe1, _mm256_loadu_si256(
+        (const __m256i *)(block1 + 32)
+      )),
+      _mm256_cmpeq_epi8(probe2, _mm256_loadu_si256(
+        (const __m256i *)(block2 + 32)
+      ))
+    );
+    
+    if (_mm256_testz_si256(_mm256_or_si256(eq0, eq1), _mm256_set1_epi8(-1))) {
+      continue;
+    }
+    
+    mask = (unsigned int)_mm256_movemask_epi8(eq0) | 
+      ((unsigned long long)(unsigned int)_mm256_movemask_epi8(eq1) << 32);
+    while (mask) {
+      bit = (unsigned int)__builtin_ctzll(mask);
+      if (memcmp(haystack + i + bit, needle, needleLength) == 0) {
+        return i + bit;
+      }
+      mask &= mask - 1;
+    }
+  }
+  
+  rest = cs_search_sse2(
+    haystack + i, 
+    haystackLength - i, 
+    needle, 
+    needleLength,
+    filter
+  );
+  return rest == CS_NOT_FOUND ? rest : i + rest;
+}
+#endif
+
+typedef size_t (*cs_searchKernel)(
+  const char *, 
+  size_t, 
+  const char *, 
+  size_t, 
+  const cs_filter *
+);
+
+static size_t cs_search_resolve(
+  const char *, 
+  size_t, 
+  const char *, 
+  size_t, 
+  const cs_filter *
+);
+
+// Filter kernel for this CPU, picked on first use. Threads may race to
+// pick it, so it is read and written atomically.
+static cs_searchKernel cs_search_filter = cs_search_resolve;
+
+static size_t cs_search_resolve(
+  const char *haystack,
+  size_t haystackLength,
+  const char *needle,
+  size_t needleLength,
+  const cs_filter *filter
+) {
+  cs_searchKernel kernel;
+  
+#if CS_X86_SIMD
+  __builtin_cpu_init();
+  kernel = __builtin_cpu_supports("avx2") 
+    ? cs_search_avx2 
+    : cs_search_sse2;
+#else
+  kernel = cs_search_scalar;
+#endif
+  
+  __atomic_store_n(&cs_search_filter, kernel, __ATOMIC_RELAXED);
+  return kernel(
+    haystack, 
+    haystackLength, 
+    needle, 
+    needleLength, 
+    filter
+  );
+}
+
+size_t cs_search(
+  const char *haystack,
+  size_t haystackLength,
+  const char *needle,
+  size_t needleLength
+) {
+  const char *hit;
+  cs_twoWay tw;
+  cs_filter filter;
+  
+  if (needleLength == 0) {
+    return 0;
+  }
+  
+  if (needleLength > haystackLength) {
+    return CS_NOT_FOUND;
+  }
+  
+  if (needleLength == 1) {
+    hit = (const char *)memchr(haystack, needle[0], haystackLength);
+    return hit ? (size_t)(hit - haystack) : CS_NOT_FOUND;
+  }
+  
+  // Long needles get Two-Way's linear worst case instead of the filter's
+  if (needleLength >= CS_LONG_NEEDLE) {
+    cs_twoWay_prepare(&tw, needle, needleLength);
+    return cs_twoWay_search(
+      &tw, 
+      haystack, 
+      haystackLength, 
+      needle, 
+      needleLength
+    );
+  }
+  
+  filter.offset1 = 0;
+  filter.offset2 = needleLength - 1;
+  filter.byte1 = needle[0];
+  filter.byte2 = needle[needleLength - 1];
+  
+  return __atomic_load_n(&cs_search_filter, __ATOMIC_RELAXED)(
+    haystack, 
+    haystackLength, 
+    needle, 
+    needleLength, 
+    &filter
+  );
+}
+
+// Backward counterparts of the filter kernels: windows are visited from
+// the end of the haystack, so the first verified hit is the last match.
+// The last needle byte is the anchor and the first byte the second probe.
+static size_t cs_searchLast_scalar(
+  const char *haystack,
+  size_t haystackLength,
+  const char *needle,
+  size_t needleLength,
+  const cs_filter *filter
+) {
+  size_t i;
+  
+  if (needleLength > haystackLength) {
+    return CS_NOT_FOUND;
+  }
+  
+  i = haystackLength - needleLength + 1;
+  while (i--) {
+    if (
+      haystack[i + filter->offset2] == filter->byte2 &&
+      haystack[i + filter->offset1] == filter->byte1 &&
+      memcmp(haystack + i, needle, needleLength) == 0
+    ) {
+      return i;
+    }
+  }
+  
+  return CS_NOT_FOUND;
+}
+
+#if CS_X86_SIMD
+static size_t cs_searchLast_sse2(
+  const char *haystack,
+  size_t haystackLength,
+  const char *needle,
+  size_t needleLength,
+  const cs_filter *filter
+) {
+  const __m128i probe1 = _mm_set1_epi8(filter->byte1);
+  const __m128i probe2 = _mm_set1_epi8(filter->byte2);
+  size_t end;
+  unsigned int mask;
+  unsigned int bit;
+  
+  if (needleLength > haystackLength) {
+    return CS_NOT_FOUND;
+  }
+  
+  // Windows [0, end) are still unchecked
+  end = haystackLength - needleLength + 1;
+  for (; end >= 16; end -= 16) {
+    const char *block = haystack + end - 16;
+    
+    mask = (unsigned int)_mm_movemask_epi8(_mm_and_si128(
+      _mm_cmpeq_epi8(probe2, _mm_loadu_si128(
+        (const __m128i *)(block + filter->offset2)
+      )),
+      _mm_cmpeq_epi8(probe1, _mm_loadu_si128(
+        (const __m128i *)(block + filter->offset1)
+      ))
+    ));
+    
+    while (mask) {
+      bit = 31 - (unsigned int)__builtin_clz(mask);
+      if (memcmp(block + bit, needle, needleLength) == 0) {
+        return end - 16 + bit;
+      }
+      mask &= ~(1u << bit);
+    }
+  }
+  
+  return cs_searchLast_scalar(
+    haystack, 
+    end + needleLength - 1, 
+    needle, 
+    needleLength, 
+    filter
+  );
+}
+
+__attribute__((target("avx2")))
+static size_t cs_searchLast_avx2(
+  const char *haystack,
+  size_t haystackLength,
+  const char *needle,
+  size_t needleLength,
+  const cs_filter *filter
+) {
+  const __m256i probe1 = _mm256_set1_epi8(filter->byte1);
+  const __m256i probe2 = _mm256_set1_epi8(filter->byte2);
+  size_t end;
+  unsigned long long mask;
+  unsigned int bit;
+  
+  if (needleLength > haystackLength) {
+    return CS_NOT_FOUND;
+  }
+  
+  end = haystackLength - needleLength + 1;
+  for (; end >= 64; end -= 64) {
+    const char *block1 = haystack + end - 64 + filter->offset1;
+    const char *block2 = haystack + end - 64 + filter->offset2;
+    __m256i eq0 = _mm256_and_si256(
+      _mm256_cmpeq_epi8(probe2, _mm256_loadu_si256((const __m256i *)block2)),
+      _mm256_cmpeq_epi8(probe1, _mm256_loadu_si256((const __m256i *)block1))
+    );
+    __m256i eq1 = _mm256_and_si256(
+      _mm256_cmpeq_epi8(probe2, _mm256_loadu_si256(
+        (const __m256i *)(block2 + 32)
+      )),
+      _mm256_cmpeq_epi8(probe1, _mm256_loadu_si256(
+        (const __m256i *)(block1 + 32)
+      ))
+    );
+    
+    if (_mm256_testz_si256(_mm256_or_si256(eq0, eq1), _mm256_set1_epi8(-1))) {
+      continue;
+    }
+    
+    mask = (unsigned int)_mm256_movemask_epi8(eq0) | 
+      ((unsigned long long)(unsigned int)_mm256_movemask_epi8(eq1) << 32);
+    while (mask) {
+      bit = 63 - (unsigned int)__builtin_clzll(mask);
+      if (memcmp(haystack + end - 64 + bit, needle, needleLength) == 0) {
+        return end - 64 + bit;
+      }
+      mask &= ~(1ULL << bit);
+    }
+  }
+  
+  return cs_searchLast_sse2(
+    haystack, 
+    end + needleLength - 1, 
+    needle, 
+    needleLength, 
+    filter
+  );
+}
+#endif
+
+static size_t cs_searchLast_resolve(
+  const char *, 
+  size_t, 
+  const char *, 
+  size_t, 
+  const cs_filter *
+);
+
+// Picked on first use and accessed atomically, as cs_search_filter is
+static cs_searchKernel cs_searchLast_filter = cs_searchLast_resolve;
+
+static size_t cs_searchLast_resolve(
+  const char *haystack,
+  size_t haystackLength,
+  const char *needle,
+  size_t needleLength,
+  const cs_filter *filter
+) {
+  cs_searchKernel kernel;
+  
+#if CS_X86_SIMD
+  __builtin_cpu_init();
+  kernel = __builtin_cpu_supports("avx2") 
+    ? cs_searchLast_avx2 
+    : cs_searchLast_sse2;
+#else
+  kernel = cs_searchLast_scalar;
+#endif
+  
+  __atomic_store_n(&cs_searchLast_filter, kernel, __ATOMIC_RELAXED);
+  return kernel(
+    haystack, 
+    haystackLength, 
+    needle, 
+    needleLength, 
+    filter
+  );
+}
+
+size_t cs_searchLast(
+  const char *haystack,
+  size_t haystackLength,
+  const char *needle,
+  size_t needleLength
+) {
+  cs_filter filter;
+  
+  // An empty needle matches at the very end, as lastIndexOf does in JS
+  if (needleLength == 0) {
+    return haystackLength;
+  }
+  
+  if (needleLength > haystackLength) {
+    return CS_NOT_FOUND;
+  }
+  
+  filter.offset1 = 0;
+  filter.offset2 = needleLength - 1;
+  filter.byte1 = needle[0];
+  filter.byte2 = needle[needleLength - 1];
+  
+  return __atomic_load_n(&cs_searchLast_filter, __ATOMIC_RELAXED)(
+    haystack, 
+    haystackLength, 
+    needle, 
+    needleLength, 
+    &filter
+  );
+}
+
+// Rough frequency of a byte in text and markup, higher being more common;
+// compiled patterns probe their two rarest bytes
+static int cs_byteRank(unsigned char c) {
+  if (c == ' ') {
+    return 255;
+  }
+  if (strchr("etaoinsrhl", c) && c) {
+    return 220;
+  }
+  if (c >= 'a' && c <= 'z') {
+    return 180;
+  }
+  if (c == '\n' || c == '\t' || c == '\r') {
+    return 170;
+  }
+  if (strchr("\".,:;=/-_<>()", c) && c) {
+    return 150;
+  }
+  if (c >= '0' && c <= '9') {
+    return 130;
+  }
+  if (c >= 'A' && c <= 'Z') {
+    return 110;
+  }
+  if (c >= 0x20 && c < 0x7f) {
+    return 60;
+  }
+  
+  // Control characters and bytes outside ASCII
+  return 20;
+}
+
+struct cs_pattern {
+  const cs_allocator *allocator; // where the pattern was allocated
+  size_t length;        // needle length in bytes
+  cs_filter filter;     // rare byte probes for short needles
+  cs_twoWay *twoWay;    // precomputed Two-Way state for long needles
+  char needle[];        // copy of the needle, NUL terminated
+};
+
+cs_pattern *cs_pattern_compile(const char *needle) {
+  return cs_pattern_compileBytes(needle, strlen(needle));
+}
+
+cs_pattern *cs_pattern_compileBytes(const char *needle, size_t length) {
+  const cs_allocator *allocator = cs_globalAllocator;
+  cs_pattern *pattern;
+  size_t i, rarest, runnerUp;
+  int rank;
+  
+  pattern = (cs_pattern *)allocator->allocate(
+    allocator->context, 
+    sizeof(cs_pattern) + length + 1
+  );
+  if (!pattern) {
+    return 0L;
+  }
+  
+  memset(pattern, 0L, sizeof(cs_pattern));
+  pattern->allocator = allocator;
+  memcpy(pattern->needle, needle, length);
+  pattern->needle[length] = '\0';
+  pattern->length = length;
+  
+  if (length >= CS_LONG_NEEDLE) {
+    pattern->twoWay = (cs_twoWay *)allocator->allocate(
+      allocator->context, 
+      sizeof(cs_twoWay)
+    );
+    if (!pattern->twoWay) {
+      allocator->release(
+        allocator->context, 
+        pattern, 
+        sizeof(cs_pattern) + length + 1
+      );
+      return 0L;
+    }
+    cs_twoWay_prepare(pattern->twoWay, pattern->needle, length);
+  }
+  else if (length >= 2) {
+    // Probe the two rarest bytes, defaulting to the first and last
+    rarest = length - 1;
+    runnerUp = 0;
+    if (cs_byteRank((unsigned char)needle[runnerUp]) < 
+        cs_byteRank((unsigned char)needle[rarest])) {
+      rarest = 0;
+      runnerUp = length - 1;
+    }
+    for (i = 1; i + 1 < length; i++) {
+      rank = cs_byteRank((unsigned char)needle[i]);
+      if (rank < cs_byteRank((unsigned char)needle[rarest])) {
+        runnerUp = rarest;
+        rarest = i;
+      }
+      else if (
+        rank < cs_byteRank((unsigned char)needle[runnerUp]) && 
+        needle[i] != needle[rarest]
+      ) {
+        runnerUp = i;
+      }
+    }
+    
+    pattern->filter.offset1 = rarest < runnerUp ? rarest : runnerUp;
+    pattern->filter.offset2 = rarest < runnerUp ? runnerUp : rarest;
+    pattern->filter.byte1 = needle[pattern->filter.offset1];
+    pattern->filter.byte2 = needle[pattern->filter.offset2];
+  }
+  
+  return pattern;
+}
+
+void cs_pattern_free(cs_pattern *pattern) {
+  const cs_allocator *allocator;
+  
+  if (!pattern) {
+    return;
+  }
+  
+  allocator = pattern->allocator;  
+  if (pattern->twoWay) {
+    allocator->release(allocator->context, pattern->twoWay, sizeof(cs_twoWay));
+  }
+  allocator->release(
+    allocator->context, 
+    pattern, 
+    sizeof(cs_pattern) + pattern->length + 1
+  );
+}
+
+size_t cs_pattern_length(const cs_pattern *pattern) {
+  return pattern->length;
+}
+
+size_t cs_pattern_search(
+  const cs_pattern *pattern,
+  const char *haystack,
+  size_t haystackLength
+) {
+  const char *hit;
+  
+  if (pattern->length == 0) {
+    return 0;
+  }
+  
+  if (pattern->length > haystackLength) {
+    return CS_NOT_FOUND;
+  }
+  
+  if (pattern->length == 1) {
+    hit = (const char *)memchr(haystack, pattern->needle[0], haystackLength);
+    return hit ? (size_t)(hit - haystack) : CS_NOT_FOUND;
+  }
+  
+  if (pattern->twoWay) {
+    return cs_twoWay_search(
+      pattern->twoWay, 
+      haystack, 
+      haystackLength, 
+      pattern->needle, 
+      pattern->length
+    );
+  }
+  
+  return __atomic_load_n(&cs_search_filter, __ATOMIC_RELAXED)(
+    haystack, 
+    haystackLength, 
+    pattern->needle, 
+    pattern->length, 
+    &pattern->filter
+  );
+}
+
+size_t cs_pattern_indexOf(const cs_pattern *pattern, const char *haystack) {
+  return cs_pattern_search(pattern, haystack, strlen(haystack));
+}
+
+BOOL cs_pattern_includes(const cs_pattern *pattern, const char *haystack) {
+  return cs_pattern_indexOf(pattern, haystack) != CS_NOT_FOUND;
+}
+
+size_t cs_pattern_countBytes(
+  const cs_pattern *pattern,
+  const char *haystack,
+  size_t haystackLength
+) {
+  size_t count = 0;
+  size_t offset = 0;
+  size_t index;
+  
+  // An empty needle matches between every pair of bytes and at both ends
+  if (pattern->length == 0) {
+    return haystackLength + 1;
+  }
+  
+  for (;;) {
+    index = cs_pattern_search(
+      pattern, 
+      haystack + offset, 
+      haystackLength - offset
+    );
+    if (index == CS_NOT_FOUND) {
+      break;
+    }
+    
+    count++;
+    offset += index + pattern->length;
+  }
+  
+  return count;
+}
+
+size_t cs_pattern_count(const cs_pattern *pattern, const char *haystack) {
+  return cs_pattern_countBytes(pattern, haystack, strlen(haystack));
+}
+
+// Set in a transition when the target state reports at least one needle
+#define CS_AC_OUTPUT 0x80000000u
+#define CS_AC_NONE ((size_t)-1)
+
+struct cs_patternSet {
+  const cs_allocator *allocator; // where the set was allocated
+  size_t needles;                // number of needles compiled
+  size_t classes;                // byte classes, i.e. row width
+  size_t states;                 // automaton states
+  size_t capacity;               // state slots allocated per array
+  size_t rows;                   // rows allocated in the table
+  unsigned char classOf[256];    // byte to class; 0 for unused bytes
+  unsigned int *table;           // states x classes, pre-multiplied targets
+  size_t *terminal;              // first needle ending at each state
+  size_t *dictionary;            // nearest suffix state with a terminal
+  size_t *sameNext;              // next needle with identical bytes
+  size_t *lengths;               // length of each needle
+  size_t empty;                  // first empty needle, or CS_AC_NONE
+};
+
+static void cs_patternSet_release(cs_patternSet *set) {
+  const cs_allocator *allocator = set->allocator;
+  
+  if (set->table) {
+    allocator->release(
+      allocator->context, 
+      set->table, 
+      set->rows * set->classes * sizeof(unsigned int)
+    );
+  }
+  if (set->terminal) {
+    allocator->release(
+      allocator->context, 
+      set->terminal, 
+      set->capacity * 2 * sizeof(size_t)
+    );
+  }
+  if (set->sameNext) {
+    allocator->release(
+      allocator->context, 
+      set->sameNext, 
+      (set->needles ? set->needles : 1) * 2 * sizeof(size_t)
+    );
+  }
+  allocator->release(allocator->context, set, sizeof(cs_patternSet));
+}
+
+cs_patternSet *cs_patternSet_compile(const char **needles, size_t count) {
+  const cs_allocator *allocator = cs_globalAllocator;
+  cs_patternSet *set;
+  unsigned int *row;
+  size_t *fail;
+  size_t *queue;
+  size_t total, i, j, state, next, head, tail, c;
+  unsigned char byte;
+  
+  set = (cs_patternSet *)allocator->allocate(
+    allocator->context, 
+    sizeof(cs_patternSet)
+  );
+  if (!set) {
+    return 0L;
+  }
+  
+  memset(set, 0L, sizeof(cs_patternSet));
+  set->allocator = allocator;
+  set->needles = count;
+  set->empty = CS_AC_NONE;
+  
+  // Bytes no needle uses share class 0, which keeps rows narrow
+  total = 0;
+  set->classes = 1;
+  for (i = 0; i < count; i++) {
+    for (j = 0; needles[i][j]; j++) {
+      byte = (unsigned char)needles[i][j];
+      if (!set->classOf[byte]) {
+        set->classOf[byte] = (unsigned char)set->classes++;
+      }
+    }
+    total += j;
+  }
+  
+  // The trie can never need more states than there are needle bytes
+  set->capacity = total + 1;
+  if (set->capacity * set->classes >= CS_AC_OUTPUT) {
+    cs_patternSet_release(set);
+    return 0L;
+  }
+  
+  set->table = (unsigned int *)allocator->allocate(
+    allocator->context, 
+    set->capacity * set->classes * sizeof(unsigned int)
+  );
+  set->rows = set->table ? set->capacity : 0;
+  set->terminal = (size_t *)allocator->allocate(
+    allocator->context, 
+    set->capacity * 2 * sizeof(size_t)
+  );
+  set->sameNext = (size_t *)allocator->allocate(
+    allocator->context, 
+    (count ? count : 1) * 2 * sizeof(size_t)
+  );
+  fail = (size_t *)allocator->allocate(
+    allocator->context, 
+    set->capacity * 2 * sizeof(size_t)
+  );
+  if (!set->table || !set->terminal || !set->sameNext || !fail) {
+    if (fail) {
+      allocator->release(
+        allocator->context, 
+        fail, 
+        set->capacity * 2 * sizeof(size_t)
+      );
+    }
+    cs_patternSet_release(set);
+    return 0L;
+  }
+  
+  set->dictionary = set->terminal + set->capacity;
+  set->lengths = set->sameNext + count;
+  queue = fail + set->capacity;
+  memset(set->table, 0L, set->rows * set->classes * sizeof(unsigned int));
+  for (i = 0; i < set->capacity; i++) {
+    set->terminal[i] = CS_AC_NONE;
+    set->dictionary[i] = CS_AC_NONE;
+  }
+  
+  // Build the trie; a zero transition means no child yet since the root
+  // is never anyone's child
+  set->states = 1;
+  for (i = 0; i < count; i++) {
+    state = 0;
+    for (j = 0; needles[i][j]; j++) {
+      row = set->table + state * set->classes;
+      c = set->classOf[(unsigned char)needles[i][j]];
+      if (!row[c]) {
+        row[c] = (unsigned int)set->states++;
+      }
+      state = row[c];
+    }
+    
+    set->lengths[i] = j;
+    set->sameNext[i] = CS_AC_NONE;
+    if (j == 0) {
+      set->sameNext[i] = set->empty;
+      set->empty = i;
+    }
+    else {
+      set->sameNext[i] = set->terminal[state];
+      set->terminal[state] = i;
+    }
+  }
+  
+  // Breadth first, fill in failure links and complete every row so the
+  // scan is a single table lookup per byte
+  head = tail = 0;
+  fail[0] = 0;
+  for (c = 0; c < set->classes; c++) {
+    next = set->table[c];
+    if (next) {
+      fail[next] = 0;
+      queue[tail++] = next;
+    }
+  }
+  
+  while (head < tail) {
+    state = queue[head++];
+    row = set->table + state * set->classes;
+    
+    set->dictionary[state] = set->terminal[fail[state]] != CS_AC_NONE
+      ? fail[state]
+      : set->dictionary[fail[state]];
+    
+    for (c = 0; c < set->classes; c++) {
+      next = row[c];
+      if (next) {
+        fail[next] = set->table[fail[state] * set->classes + c];
+        queue[tail++] = next;
+      }
+      else {
+        row[c] = set->table[fail[state] * set->classes + c];
+      }
+    }
+  }
+  
+  // Pre-multiply targets into row offsets and flag reporting states
+  for (i = 0; i < set->states * set->classes; i++) {
+    next = set->table[i];
+    set->table[i] = (unsigned int)(next * set->classes) | (
+      set->terminal[next] != CS_AC_NONE || 
+      set->dictionary[next] != CS_AC_NONE 
+        ? CS_AC_OUTPUT 
+        : 0
+    );
+  }
+  
+  allocator->release(
+    allocator->context, 
+    fail, 
+    set->capacity * 2 * sizeof(size_t)
+  );
+  
+  // Trim the rows left unused by shared prefixes
+  row = (unsigned int *)allocator->reallocate(
+    allocator->context,
+    set->table,
+    set->rows * set->classes * sizeof(unsigned int),
+    set->states * set->classes * sizeof(unsigned int)
+  );
+  if (row) {
+    set->table = row;
+    set->rows = set->states;
+  }
+  
+  return set;
+}
+
+void cs_patternSet_free(cs_patternSet *set) {
+  if (set) {
+    cs_patternSet_release(set);
+  }
+}
+
+// Walks the automaton over the haystack, recording matches until `limit`
+// of them have been seen; returns how many were found
+static size_t cs_patternSet_scan(
+  const cs_patternSet *set,
+  const char *haystack,
+  size_t haystackLength,
+  cs_match *matches,
+  size_t capacity,
+  size_t limit
+) {
+  const unsigned int *table = set->table;
+  const unsigned char *classOf = set->classOf;
+  const unsigned char *h = (const unsigned char *)haystack;
+  unsigned int state = 0;
+  size_t found = 0;
+  size_t i, at, id;
+  
+  for (id = set->empty; id != CS_AC_NONE; id = set->sameNext[id]) {
+    if (found == limit) {
+      return found;
+    }
+    if (found < capacity) {
+      matches[found].needle = id;
+      matches[found].offset = 0;
+    }
+    found++;
+  }
+  
+  for (i = 0; i < haystackLength && found < limit; i++) {
+    state = table[(state & ~CS_AC_OUTPUT) + classOf[h[i]]];
+    if (!(state & CS_AC_OUTPUT)) {
+      continue;
+    }
+    
+    // Report the needle ending here, then its shorter suffixes
+    at = (state & ~CS_AC_OUTPUT) / set->classes;
+    if (set->terminal[at] == CS_AC_NONE) {
+      at = set->dictionary[at];
+    }
+    for (; at != CS_AC_NONE; at = set->dictionary[at]) {
+      for (id = set->terminal[at]; id != CS_AC_NONE; id = set->sameNext[id]) {
+        if (found == limit) {
+          return found;
+        }
+        if (found < capacity) {
+          matches[found].needle = id;
+          matches[found].offset = i + 1 - set->lengths[id];
+        }
+        found++;
+      }
+    }
+  }
+  
+  return found;
+}
+
+BOOL cs_includesAnyBytes(
+  const cs_patternSet *set,
+  const char *haystack,
+  size_t haystackLength,
+  cs_match *firstMatch
+) {
+  cs_match match;
+  
+  if (!cs_patternSet_scan(set, haystack, haystackLength, &match, 1, 1)) {
+    return FALSE;
+  }
+  
+  if (firstMatch) {
+    *firstMatch = match;
+  }
+  return TRUE;
+}
+
+BOOL cs_includesAny(
+  const cs_patternSet *set,
+  const char *haystack,
+  cs_match *firstMatch
+) {
+  return cs_includesAnyBytes(set, haystack, strlen(haystack), firstMatch);
+}
+
+size_t cs_matchAllBytes(
+  const cs_patternSet *set,
+  const char *haystack,
+  size_t haystackLength,
+  cs_match *matches,
+  size_t capacity
+) {
+  return cs_patternSet_scan(
+    set, 
+    haystack, 
+    haystackLength, 
+    matches, 
+    capacity, 
+    (size_t)-1
+  );
+}
+
+size_t cs_matchAll(
+  const cs_patternSet *set,
+  const char *haystack,
+  cs_match *matches,
+  size_t capacity
+) {
+  return cs_matchAllBytes(set, haystack, strlen(haystack), matches, capacity);
+}
+
+char *cs_padEnd(char *string, size_t length) {
+  return cs_padEndWith(string, length, CS_DEFAULT_PADSTRING);
+}
+
+char *cs_padEndWith(char *string, size_t length, const char *padString) {
+  StringAction sa;
+  cs_heapAction(&sa, string);
+  return cssa_padEndWith(&sa, length, padString);
+}
+
+char *cssa_padEndWith(
+  StringAction *action,
+  size_t length,
+  const char *padString
+) {
+  const char *padding;
+  size_t padLen;
+  size_t strLen;
+  
+  padding = padString ? padString : CS_DEFAULT_PADSTRING;
+  
+  strLen = action->length;
+  padLen = strlen(padding);
+  
+  if (strLen >= length || !padLen) {
+    action->lastAction |= CSSA_SKIPPED;
+    return action->string;
+  }
+  
+  if (!cs_grow(action, length + 1)) {
+    fprintf(stderr, "Could not allocate memory!");
+    return action->string;
+  }
+
+  cs_fill(&action->string[strLen], length - strLen, padding, padLen);
+  action->string[length] = '\0';
+  
+  action->length = length;
+  
+  return action->string;
+}
+
+char *cs_padStart(char *string, size_t length) {
+  return cs_padStartWith(string, length, CS_DEFAULT_PADSTRING);
+}
+
+char *cs_padStartWith(char *string, size_t length, const char *padString) {
+  StringAction sa;
+  cs_heapAction(&sa, string);
+  return cssa_padStartWith(&sa, length, padString);
+}
+
+char *cssa_padStartWith(
+  StringAction *action,
+  size_t length,
+  const char *padString
+) {
+  const char *padding;
+  size_t strLen;   // String length
+  size_t padLen;   // Length of padding string
+  size_t diffLen;  // Length of difference between desired and original  
+  
+  if (!action) {
+    return NULL;
+  }
+  
+  if (!action->string) {
+    cssa_flags(action, CSSA_FAILED);
+    return NULL;
+  }
+  
+  strLen = action->length;
+  padding = padString ? padString : CS_DEFAULT_PADSTRING;
+  padLen = strlen(padding);
+  
+  if (strLen >= length || !padLen) {
+    action->lastAction |= CSSA_SKIPPED;
+    return action->string;
+  }
+  
+  // At most one grow; existing capacity is reused as is
+  if (!cs_grow(action, length + 1)) {
+    fprintf(stderr, "Could not allocate memory!");
+    return action->string;
+  }
+  
+  // Shift the original (and its terminator) right, then fill the gap
+  diffLen = length - strLen;
+  memmove(&action->string[diffLen], action->string, strLen + 1);
+  cs_fill(action->string, diffLen, padding, padLen);
+  action->length = length;
+  
+  return action->string;
+}
+
+char *cs_repeat(char *string, unsigned int times) {
+  StringAction sa; 
+  cs_heapAction(&sa, string);
+  return cssa_repeat(&sa, times);
+}
+
+char *cssa_repeat(StringAction *action, unsigned int times) {
+  char *buffer;
+  size_t total;
+  
+  if (!action) {
+    return NULL;
+  }
+  
+  if (times && action->length > ((size_t)-1 - 1) / times) {
+    action->lastAction |= CSSA_FAILED;
+    return NULL;
+  }
+  
+  // The result is the caller's to free(), whatever the action's allocator;
+  // cs_arena_repeat builds one inside an arena instead
+  total = action->length * times;
+  buffer = (char *)malloc((total + 1) * sizeof(char));
+  if (!buffer) {
+    action->lastAction |= CSSA_FAILED;
+    return NULL;
+  }
+  
+  cs_repeatInto(action->string, action->length, times, buffer, total + 1);
+  
+  return buffer;
+}
+
+char *cssa_repeatInto(
+  StringAction *action,
+  unsigned int times,
+  char *buffer,
+  size_t capacity
+) {
+  if (!action) {
+    return NULL;
+  }
+  
+  if (
+    cs_repeatInto(action->string, action->length, times, buffer, capacity) 
+      == CS_NOT_FOUND
+  ) {
+    action->lastAction |= CSSA_SKIPPED;
+    return NULL;
+  }
+  
+  return buffer;
+}
+
+cs_view cs_viewOf(const char *string) {
+  cs_view view;
+  
+  view.ptr = string;
+  view.len = string ? strlen(string) : 0;
+  
+  return view;
+}
+
+cs_view cs_viewOfBytes(const char *bytes, size_t length) {
+  cs_view view;
+  
+  view.ptr = bytes;
+  view.len = length;
+  
+  return view;
+}
+
+cs_view cssa_view(const StringAction *action) {
+  return cs_viewOfBytes(action->string, action->length);
+}
+
+StringAction *cs_copyView(cs_view view) {
+  return cs_copyBytesUsing(0L, view.ptr, view.len, view.len + 1, 0L);
+}
+
+StringAction *cs_copyViewUsing(const cs_allocator *allocator, cs_view view) {
+  return cs_copyBytesUsing(allocator, view.ptr, view.len, view.len + 1, 0L);
+}
+
+StringAction *cssa_concatView(StringAction *action, cs_view extra) {
+  return cssa_append(action, extra.ptr, extra.len);
+}
+
+StringAction *cssa_concatViews(
+  StringAction *action,
+  const cs_view *parts,
+  size_t count
+) {
+  if (!action || !parts) {
+    return action;
+  }
+  
+  return cs_appendJoined(action, parts, count, cs_viewOf(CS_EMPTY_STRING));
+}
+
+StringAction *cs_view_join(
+  const cs_view *parts,
+  size_t count,
+  cs_view separator
+) {
+  StringAction *result;
+  size_t total;
+  char *end;
+  
+  total = cs_joinedLength(parts, parts ? count : 0, separator);
+  if (total == CS_NOT_FOUND) {
+    return 0L;
+  }
+  
+  result = cs_newUsing(0L, total + 1);
+  if (!result || !result->string) {
+    return result;
+  }
+  
+  end = cs_writeJoined(
+    result->string, 
+    parts, 
+    parts ? count : 0, 
+    separator, 
+    0, 
+    0, 
+    0L
+  );
+  result->length = (size_t)(end - result->string);
+  result->string[result->length] = '\0';
+  
+  return result;
+}
+
+cs_view cs_view_slice(cs_view string, size_t start, size_t end) {
+  start = start < string.len ? start : string.len;
+  end = end < string.len ? end : string.len;
+  
+  return cs_viewOfBytes(string.ptr + start, end > start ? end - start : 0);
+}
+
+cs_view cs_slice(const char *string, size_t start, size_t end) {
+  // Only the bytes up to `end` are measured
+  return cs_view_slice(
+    cs_viewOfBytes(string, strnlen(string, end)), 
+    start, 
+    end
+  );
+}
+
+cs_view cssa_slice(const StringAction *action, size_t start, size_t end) {
+  return cs_view_slice(cssa_view(action), start, end);
+}
+
+size_t cs_view_indexOf(cs_view haystack, cs_view needle) {
+  return cs_search(haystack.ptr, haystack.len, needle.ptr, needle.len);
+}
+
+size_t cs_view_lastIndexOf(cs_view haystack, cs_view needle) {
+  return cs_searchLast(haystack.ptr, haystack.len, needle.ptr, needle.len);
+}
+
+size_t cs_view_lastIndexOfFrom(
+  cs_view haystack, 
+  cs_view needle, 
+  size_t fromIndex
+) {
+  if (fromIndex < haystack.len && haystack.len - fromIndex > needle.len) {
+    haystack.len = fromIndex + needle.len;
+  }
+  
+  return cs_searchLast(haystack.ptr, haystack.len, needle.ptr, needle.len);
+}
+
+BOOL cs_view_includes(cs_view haystack, cs_view needle) {
+  return cs_view_indexOf(haystack, needle) != CS_NOT_FOUND;
+}
+
+BOOL cs_view_includesAt(cs_view haystack, cs_view needle, size_t fromIndex) {
+  if (fromIndex > haystack.len) {
+    fromIndex = haystack.len;
+  }
+  
+  return cs_search(
+    haystack.ptr + fromIndex, 
+    haystack.len - fromIndex, 
+    needle.ptr, 
+    needle.len
+  ) != CS_NOT_FOUND;
+}
+
+BOOL cs_view_startsWith(cs_view string, cs_view prefix) {
+  return prefix.len <= string.len && 
+    memcmp(string.ptr, prefix.ptr, prefix.len) == 0;
+}
+
+BOOL cs_view_endsWith(cs_view string, cs_view ending) {
+  return ending.len <= string.len && 
+    memcmp(string.ptr + string.len - ending.len, ending.ptr, ending.len) == 0;
+}
+
+int cs_view_compare(cs_view a, cs_view b) {
+  int result;
+  
+  result = memcmp(a.ptr, b.ptr, a.len < b.len ? a.len : b.len);
+  if (result) {
+    return result;
+  }
+  
+  return a.len < b.len ? -1 : a.len > b.len ? 1 : 0;
+}
+
+BOOL cs_view_equals(cs_view a, cs_view b) {
+  return a.len == b.len && memcmp(a.ptr, b.ptr, a.len) == 0;
+}
+
+StringAction *cs_view_concat(cs_view a, cs_view b) {
+  StringAction *result;
+  
+  result = cs_copyBytesUsing(0L, a.ptr, a.len, a.len + b.len + 1, 0L);
+  if (result && !cssa_test(result, CSSA_FAILED)) {
+    cssa_append(result, b.ptr, b.len);
+  }
+  
+  return result;
+}
+
+StringAction *cs_view_padEnd(cs_view string, size_t length, cs_view pad) {
+  StringAction *result;
+  
+  result = cs_copyBytesUsing(0L, string.ptr, string.len, length + 1, 0L);
+  if (!result || cssa_test(result, CSSA_FAILED)) {
+    return result;
+  }
+  
+  if (string.len >= length || pad.len == 0) {
+    result->lastAction |= CSSA_SKIPPED;
+    return result;
+  }
+  
+  cs_fill(
+    &result->string[string.len], 
+    length - string.len, 
+    pad.ptr, 
+    pad.len
+  );
+  result->string[length] = '\0';
+  result->length = length;
+  
+  return result;
+}
+
+StringAction *cs_view_padStart(cs_view string, size_t length, cs_view pad) {
+  StringAction *result;
+  size_t fill;
+  
+  if (string.len >= length || pad.len == 0) {
+    result = cs_copyView(string);
+    if (result) {
+      result->lastAction |= CSSA_SKIPPED;
+    }
+    return result;
+  }
+  
+  result = cs_newUsing(0L, length + 1);
+  if (!result || !result->string) {
+    return result;
+  }
+  
+  fill = length - string.len;
+  cs_fill(result->string, fill, pad.ptr, pad.len);
+  memcpy(&result->string[fill], string.ptr, string.len);
+  result->string[length] = '\0';
+  result->length = length;
+  
+  return result;
+}
+
+StringAction *cs_view_repeat(cs_view string, unsigned int times) {
+  StringAction *result;
+  size_t total;
+  
+  if (times && string.len > ((size_t)-1 - 1) / times) {
+    return 0L;
+  }
+  
+  total = string.len * times;
+  result = cs_newUsing(0L, total + 1);
+  if (!result || !result->string) {
+    return result;
+  }
+  
+  cs_repeatInto(string.ptr, string.len, times, result->string, result->size);
+  result->length = total;
+  
+  return result;
+}
+
+// Segments are either a run of bytes used once (unit == total) or a block
+// of whole pattern copies repeated until `total` bytes are produced
+typedef struct cs_segment {
+  const char *bytes;    // referenced bytes, or `owned`
+  size_t unit;          // bytes in one emitted block
+  size_t total;         // bytes the segment produces
+  char *owned;          // pre-filled pattern block, released with the segment
+} cs_segment;
+
+struct cs_compose {
+  const cs_allocator *allocator;
+  cs_segment *segments;
+  size_t count;
+  size_t capacity;
+  size_t length;        // total bytes the composition produces
+  BOOL failed;          // a recording call could not allocate
+};
+
+cs_compose *cs_compose_create(void) {
+  return cs_compose_createUsing(cs_globalAllocator);
+}
+
+cs_compose *cs_compose_createUsing(const cs_allocator *allocator) {
+  cs_compose *compose;
+  
+  if (!allocator) {
+    allocator = cs_globalAllocator;
+  }
+  
+  compose = (cs_compose *)allocator->allocate(
+    allocator->context, 
+    sizeof(cs_compose)
+  );
+  if (!compose) {
+    return 0L;
+  }
+  
+  memset(compose, 0L, sizeof(cs_compose));
+  compose->allocator = allocator;
+  
+  return compose;
+}
+
+void cs_compose_reset(cs_compose *compose) {
+  const cs_allocator *allocator;
+  size_t i;
+  
+  if (!compose) {
+    return;
+  }
+  
+  allocator = compose->allocator;
+  for (i = 0; i < compose->count; i++) {
+    if (compose->segments[i].owned) {
+      allocator->release(
+        allocator->context, 
+        compose->segments[i].owned, 
+        compose->segments[i].unit
+      );
+    }
+  }
+  
+  compose->count = 0;
+  compose->length = 0;
+  compose->failed = FALSE;
+}
+
+void cs_compose_free(cs_compose *compose) {
+  const cs_allocator *allocator;
+  
+  if (!compose) {
+    return;
+  }
+  
+  cs_compose_reset(compose);
+  allocator = compose->allocator;
+  if (compose->segments) {
+    allocator->release(
+      allocator->context, 
+      compose->segments, 
+      compose->capacity * sizeof(cs_segment)
+    );
+  }
+  allocator->release(allocator->context, compose, sizeof(cs_compose));
+}
+
+size_t cs_compose_length(const cs_compose *compose) {
+  return compose ? compose->length : 0;
+}
+
+BOOL cs_compose_failed(const cs_compose *compose) {
+  return !compose || compose->failed;
+}
+
+// Opens a slot for a segment at `index`, shifting later segments along
+static cs_segment *cs_compose_insert(cs_compose *compose, size_t index) {
+  const cs_allocator *allocator = compose->allocator;
+  cs_segment *grown;
+  size_t capacity;
+  
+  if (compose->count == compose->capacity) {
+    capacity = compose->capacity ? compose->capacity * 2 : 8;
+    grown = (cs_segment *)allocator->reallocate(
+      allocator->context,
+      compose->segments,
+      compose->capacity * sizeof(cs_segment),
+      capacity * sizeof(cs_segment)
+    );
+    if (!grown) {
+      compose->failed = TRUE;
+      return 0L;
+    }
+    compose->segments = grown;
+    compose->capacity = capacity;
+  }
+  
+  memmove(
+    &compose->segments[index + 1], 
+    &compose->segments[index], 
+    (compose->count - index) * sizeof(cs_segment)
+  );
+  compose->count++;
+  
+  return &compose->segments[index];
+}
+
+// Records `total` bytes of the repeating pattern at `index`. Short patterns
+// are doubled up into a block once, so flushing needs few iovecs; a pattern
+// at least CS_COMPOSE_BLOCK long is referenced as is.
+#define CS_COMPOSE_BLOCK 4096
+
+static cs_compose *cs_compose_insertFill(
+  cs_compose *compose,
+  size_t index,
+  const char *pattern,
+  size_t patternLength,
+  size_t total
+) {
+  const cs_allocator *allocator = compose->allocator;
+  cs_segment *segment;
+  char *owned = 0L;
+  size_t unit;
+  
+  if (!total || !patternLength) {
+    return compose;
+  }
+  
+  if (total > (size_t)-1 - compose->length) {
+    compose->failed = TRUE;
+    return compose;
+  }
+  
+  unit = patternLength;
+  if (patternLength < CS_COMPOSE_BLOCK && total > patternLength) {
+    unit = CS_COMPOSE_BLOCK - CS_COMPOSE_BLOCK % patternLength;
+    if (unit > total) {
+      unit = total;
+    }
+    
+    owned = (char *)allocator->allocate(allocator->context, unit);
+    if (!owned) {
+      compose->failed = TRUE;
+      return compose;
+    }
+    cs_fill(owned, unit, pattern, patternLength);
+    pattern = owned;
+  }
+  
+  segment = cs_compose_insert(compose, index);
+  if (!segment) {
+    if (owned) {
+      allocator->release(allocator->context, owned, unit);
+    }
+    return compose;
+  }
+  
+  segment->bytes = pattern;
+  segment->unit = unit;
+  segment->total = total;
+  segment->owned = owned;
+  compose->length += total;
+  
+  return compose;
+}
+
+cs_compose *cs_compose_append(
+  cs_compose *compose,
+  const char *bytes,
+  size_t length
+) {
+  cs_segment *segment;
+  
+  if (!compose || !bytes || !length) {
+    return compose;
+  }
+  
+  if (length > (size_t)-1 - compose->length) {
+    compose->failed = TRUE;
+    return compose;
+  }
+  
+  segment = cs_compose_insert(compose, compose->count);
+  if (segment) {
+    segment->bytes = bytes;
+    segment->unit = length;
+    segment->total = length;
+    segment->owned = 0L;
+    compose->length += length;
+  }
+  
+  return compose;
+}
+
+cs_compose *cs_compose_concat(cs_compose *compose, const char *string) {
+  return string ? cs_compose_append(compose, string, strlen(string)) : compose;
+}
+
+cs_compose *cs_compose_concatView(cs_compose *compose, cs_view string) {
+  return cs_compose_append(compose, string.ptr, string.len);
+}
+
+cs_compose *cs_compose_repeat(
+  cs_compose *compose,
+  const char *string,
+  unsigned int times
+) {
+  size_t length;
+  
+  if (!compose || !string) {
+    return compose;
+  }
+  
+  length = strlen(string);
+  if (times && length > ((size_t)-1) / times) {
+    compose->failed = TRUE;
+    return compose;
+  }
+  
+  return cs_compose_insertFill(
+    compose, 
+    compose->count, 
+    string, 
+    length, 
+    length * times
+  );
+}
+
+cs_compose *cs_compose_padEnd(cs_compose *compose, size_t length) {
+  return cs_compose_padEndWith(compose, length, CS_DEFAULT_PADSTRING);
+}
+
+cs_compose *cs_compose_padEndWith(
+  cs_compose *compose,
+  size_t length,
+  const char *padString
+) {
+  const char *padding = padString ? padString : CS_DEFAULT_PADSTRING;
+  
+  if (!compose || compose->length >= length) {
+    return compose;
+  }
+  
+  return cs_compose_insertFill(
+    compose, 
+    compose->count, 
+    padding, 
+    strlen(padding), 
+    length - compose->length
+  );
+}
+
+cs_compose *cs_compose_padStart(cs_compose *compose, size_t length) {
+  return cs_compose_padStartWith(compose, length, CS_DEFAULT_PADSTRING);
+}
+
+cs_compose *cs_compose_padStartWith(
+  cs_compose *compose,
+  size_t length,
+  const char *padString
+) {
+  const char *padding = padString ? padString : CS_DEFAULT_PADSTRING;
+  
+  if (!compose || compose->length >= length) {
+    return compose;
+  }
+  
+  return cs_compose_insertFill(
+    compose, 
+    0, 
+    padding, 
+    strlen(padding), 
+    length - compose->length
+  );
+}
+
+// Writes the whole batch, resuming after short writes and interruptions
+static int cs_writevAll(int fd, struct iovec *iov, int count) {
+  ssize_t written;
+  
+  while (count > 0) {
+    written = writev(fd, iov, count);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    
+    while (count > 0 && (size_t)written >= iov->iov_len) {
+      written -= (ssize_t)iov->iov_len;
+      iov++;
+      count--;
+    }
+    if (count > 0) {
+      iov->iov_base = (char *)iov->iov_base + written;
+      iov->iov_len -= (size_t)written;
+    }
+  }
+  
+  return 0;
+}
+
+// iovecs gathered per writev call
+#define CS_COMPOSE_IOV 64
+
+ssize_t cs_compose_write(const cs_compose *compose, int fd) {
+  struct iovec iov[CS_COMPOSE_IOV];
+  const cs_segment *segment;
+  size_t produced;
+  size_t step;
+  size_t i;
+  int used = 0;
+  
+  if (cs_compose_failed(compose)) {
+    return -1;
+  }
+  
+  for (i = 0; i < compose->count; i++) {
+    segment = &compose->segments[i];
+    for (produced = 0; produced < segment->total; produced += step) {
+      step = segment->total - produced;
+      if (step > segment->unit) {
+        step = segment->unit;
+      }
+      
+      if (used == CS_COMPOSE_IOV) {
+        if (cs_writevAll(fd, iov, used) != 0) {
+          return -1;
+        }
+        used = 0;
+      }
+      iov[used].iov_base = (void *)segment->bytes;
+      iov[used].iov_len = step;
+      used++;
+    }
+  }
+  
+  if (used && cs_writevAll(fd, iov, used) != 0) {
+    return -1;
+  }
+  
+  return (ssize_t)compose->length;
+}
+
+size_t cs_compose_writeInto(
+  const cs_compose *compose,
+  char *buffer,
+  size_t capacity
+) {
+  const cs_segment *segment;
+  size_t i;
+  char *out = buffer;
+  
+  if (cs_compose_failed(compose) || !buffer || capacity <= compose->length) {
+    return CS_NOT_FOUND;
+  }
+  
+  for (i = 0; i < compose->count; i++) {
+    segment = &compose->segments[i];
+    if (segment->total == segment->unit) {
+      memcpy(out, segment->bytes, segment->total);
+    }
+    else {
+      // Blocks hold whole pattern copies, so the fill keeps its phase
+      cs_fill(out, segment->total, segment->bytes, segment->unit);
+    }
+    out += segment->total;
+  }
+  *out = '\0';
+  
+  return compose->length;
+}
+
+StringAction *cs_compose_materialize(const cs_compose *compose) {
+  StringAction *result;
+  
+  if (cs_compose_failed(compose)) {
+    return 0L;
+  }
+  
+  result = cs_newUsing(compose->allocator, compose->length + 1);
+  if (!result || !result->string) {
+    return result;
+  }
+  
+  cs_compose_writeInto(compose, result->string, result->size);
+  result->length = compose->length;
+  
+  return result;
+}
+
+// Rope nodes are immutable and shared between ropes and slices, so they are
+// reference counted (atomically, as ropes sharing them may live on other
+// threads) and remember the allocator they came from, which need not be
+// that of every rope holding them. Leaves either own their bytes (stored
+// after the node) or point into an owning leaf they keep alive; concat
+// nodes form an AVL shaped tree so its height stays logarithmic in the
+// number of leaves.
+#define CS_ROPE_CHUNK 65536     // largest leaf built from one run of bytes
+#define CS_ROPE_MERGE 1024      // adjacent leaves up to this size are merged
+#define CS_ROPE_DEPTH 128       // deeper than any AVL tree that fits memory
+
+typedef struct cs_ropeNode cs_ropeNode;
+
+struct cs_ropeNode {
+  size_t refs;          // atomic
+  const cs_allocator *allocator; // where the node was allocated
+  size_t length;        // bytes under this node
+  int height;           // 0 for leaves
+  cs_ropeNode *left;    // concat nodes only
+  cs_ropeNode *right;
+  const char *bytes;    // leaves only
+  cs_ropeNode *owner;   // leaf owning `bytes`, when not this one
+  char data[];          // bytes of an owning leaf
+};
+
+struct cs_rope {
+  const cs_allocator *allocator;
+  cs_ropeNode *root;
+  BOOL failed;          // an edit could not allocate; contents unspecified
+};
+
+static cs_ropeNode *cs_rope_retain(cs_ropeNode *node) {
+  if (node) {
+    __atomic_add_fetch(&node->refs, 1, __ATOMIC_RELAXED);
+  }
+  return node;
+}
+
+static void cs_rope_release(cs_ropeNode *node) {
+  const cs_allocator *allocator;
+  size_t size;
+  
+  if (!node || __atomic_sub_fetch(&node->refs, 1, __ATOMIC_ACQ_REL)) {
+    return;
+  }
+  
+  allocator = node->allocator;
+  size = sizeof(cs_ropeNode);
+  if (node->height) {
+    cs_rope_release(node->left);
+    cs_rope_release(node->right);
+  }
+  else if (node->owner) {
+    cs_rope_release(node->owner);
+  }
+  else {
+    size += node->length;
+  }
+  
+  allocator->release(allocator->context, node, size);
+}
+
+static cs_ropeNode *cs_rope_allocNode(cs_rope *rope, size_t dataSize) {
+  const cs_allocator *allocator = rope->allocator;
+  cs_ropeNode *node;
+  
+  node = (cs_ropeNode *)allocator->allocate(
+    allocator->context, 
+    sizeof(cs_ropeNode) + dataSize
+  );
+  if (!node) {
+    fprintf(stderr, "Could not allocate memory!");
+    rope->failed = TRUE;
+    return 0L;
+  }
+  
+  memset(node, 0L, sizeof(cs_ropeNode));
+  node->refs = 1;
+  node->allocator = allocator;
+  
+  return node;
+}
+
+// New leaf holding a copy of `length` bytes
+static cs_ropeNode *cs_rope_leaf(
+  cs_rope *rope,
+  const char *bytes,
+  size_t length
+) {
+  cs_ropeNode *node = cs_rope_allocNode(rope, length);
+  
+  if (node) {
+    memcpy(node->data, bytes, length);
+    node->bytes = node->data;
+    node->length = length;
+  }
+  
+  return node;
+}
+
+// Concat node taking over the references to both children
+static cs_ropeNode *cs_rope_pair(
+  cs_rope *rope,
+  cs_ropeNode *left,
+  cs_ropeNode *right
+) {
+  cs_ropeNode *node;
+  
+  if (!left || !right) {
+    return left ? left : right;
+  }
+  
+  node = cs_rope_allocNode(rope, 0);
+  if (!node) {
+    cs_rope_release(left);
+    cs_rope_release(right);
+    return 0L;
+  }
+  
+  node->left = left;
+  node->right = right;
+  node->length = left->length + right->length;
+  node->height = 1 + (
+    left->height > right->height ? left->height : right->height
+  );
+  
+  return node;
+}
+
+static int cs_rope_height(const cs_ropeNode *node) {
+  return node ? node->height : -1;
+}
+
+// Pairs two subtrees whose heights differ by at most two, rotating once or
+// twice to restore balance; consumes both references
+static cs_ropeNode *cs_rope_balance(
+  cs_rope *rope,
+  cs_ropeNode *left,
+  cs_ropeNode *right
+) {
+  cs_ropeNode *a, *b, *c, *d;
+  
+  if (cs_rope_height(right) > cs_rope_height(left) + 1) {
+    if (cs_rope_height(right->left) > cs_rope_height(right->right)) {
+      a = cs_rope_retain(right->left->left);
+      b = cs_rope_retain(right->left->right);
+      c = cs_rope_retain(right->right);
+      cs_rope_release(right);
+      return cs_rope_pair(
+        rope, 
+        cs_rope_pair(rope, left, a), 
+        cs_rope_pair(rope, b, c)
+      );
+    }
+    a = cs_rope_retain(right->left);
+    b = cs_rope_retain(right->right);
+    cs_rope_release(right);
+    return cs_rope_pair(rope, cs_rope_pair(rope, left, a), b);
+  }
+  
+  if (cs_rope_height(left) > cs_rope_height(right) + 1) {
+    if (cs_rope_height(left->right) > cs_rope_height(left->left)) {
+      a = cs_rope_retain(left->left);
+      b = cs_rope_retain(left->right->left);
+      c = cs_rope_retain(left->right->right);
+      cs_rope_release(left);
+      return cs_rope_pair(
+        rope, 
+        cs_rope_pair(rope, a, b), 
+        cs_rope_pair(rope, c, right)
+      );
+    }
+    d = cs_rope_retain(left->left);
+    a = cs_rope_retain(left->right);
+    cs_rope_release(left);
+    return cs_rope_pair(rope, d, cs_rope_pair(rope, a, right));
+  }
+  
+  return cs_rope_pair(rope, left, right);
+}
+
+// Concatenates two trees in O(log n) by walking down the spine of the
+// taller one; small neighbouring leaves are merged. Consumes both.
+static cs_ropeNode *cs_rope_join(
+  cs_rope *rope,
+  cs_ropeNode *left,
+  cs_ropeNode *right
+) {
+  cs_ropeNode *merged, *child;
+  
+  if (!left || !right) {
+    return left ? left : right;
+  }
+  
+  if (
+    !left->height && 
+    !right->height && 
+    left->length + right->length <= CS_ROPE_MERGE
+  ) {
+    merged = cs_rope_allocNode(rope, left->length + right->length);
+    if (merged) {
+      memcpy(merged->data, left->bytes, left->length);
+      memcpy(merged->data + left->length, right->bytes, right->length);
+      merged->bytes = merged->data;
+      merged->length = left->length + right->length;
+    }
+    cs_rope_release(left);
+    cs_rope_release(right);
+    return merged;
+  }
+  
+  if (left->height > right->height + 1) {
+    child = cs_rope_retain(left->left);
+    merged = cs_rope_join(rope, cs_rope_retain(left->right), right);
+    cs_rope_release(left);
+    return cs_rope_balance(rope, child, merged);
+  }
+  
+  if (right->height > left->height + 1) {
+    child = cs_rope_retain(right->right);
+    merged = cs_rope_join(rope, left, cs_rope_retain(right->left));
+    cs_rope_release(right);
+    return cs_rope_balance(rope, merged, child);
+  }
+  
+  return cs_rope_pair(rope, left, right);
+}
+
+// Balanced tree over `length` bytes split into leaf sized chunks
+static cs_ropeNode *cs_rope_build(
+  cs_rope *rope,
+  const char *bytes,
+  size_t length
+) {
+  size_t half;
+  
+  if (!length) {
+    return 0L;
+  }
+  
+  if (length <= CS_ROPE_CHUNK) {
+    return cs_rope_leaf(rope, bytes, length);
+  }
+  
+  // Split on a chunk boundary so every leaf but the last is full
+  half = (length / CS_ROPE_CHUNK / 2) * CS_ROPE_CHUNK;
+  if (!half) {
+    half = CS_ROPE_CHUNK;
+  }
+  
+  return cs_rope_pair(
+    rope,
+    cs_rope_build(rope, bytes, half),
+    cs_rope_build(rope, bytes + half, length - half)
+  );
+}
+
+// New reference to bytes [start, end) of `node`, sharing its leaves
+static cs_ropeNode *cs_rope_sub(
+  cs_rope *rope,
+  cs_ropeNode *node,
+  size_t start,
+  size_t end
+) {
+  cs_ropeNode *leaf;
+  size_t split;
+  
+  if (!node || start >= end) {
+    return 0L;
+  }
+  
+  if (start == 0 && end == node->length) {
+    return cs_rope_retain(node);
+  }
+  
+  if (!node->height) {
+    leaf = cs_rope_allocNode(rope, 0);
+    if (leaf) {
+      leaf->bytes = node->bytes + start;
+      leaf->length = end - start;
+      leaf->owner = cs_rope_retain(node->owner ? node->owner : node);
+    }
+    return leaf;
+  }
+  
+  split = node->left->length;
+  if (end <= split) {
+    return cs_rope_sub(rope, node->left, start, end);
+  }
+  if (start >= split) {
+    return cs_rope_sub(rope, node->right, start - split, end - split);
+  }
+  
+  return cs_rope_join(
+    rope,
+    cs_rope_sub(rope, node->left, start, split),
+    cs_rope_sub(rope, node->right, 0, end - split)
+  );
+}
+
+// `total` bytes of the repeating pattern: one block of whole copies, paired
+// with itself by doubling so that k full chunks take O(log k) nodes and
+// joins, then a slice of the block for the remainder
+static cs_ropeNode *cs_rope_fill(
+  cs_rope *rope,
+  const char *pattern,
+  size_t patternLength,
+  size_t total
+) {
+  cs_ropeNode *block, *power, *tree = 0L;
+  size_t unit;
+  size_t copies;
+  
+  if (!total || !patternLength) {
+    return 0L;
+  }
+  
+  unit = CS_ROPE_CHUNK - CS_ROPE_CHUNK % patternLength;
+  if (unit < patternLength) {
+    unit = patternLength;
+  }
+  if (unit > total) {
+    unit = total;
+  }
+  
+  if (patternLength > unit) {
+    return cs_rope_build(rope, pattern, unit);
+  }
+  
+  block = cs_rope_allocNode(rope, unit);
+  if (!block) {
+    return 0L;
+  }
+  cs_fill(block->data, unit, pattern, patternLength);
+  block->bytes = block->data;
+  block->length = unit;
+  
+  // Every copy is the same, so the powers can be joined in any order
+  power = cs_rope_retain(block);
+  for (copies = total / unit; copies; copies >>= 1) {
+    if (copies & 1) {
+      tree = cs_rope_join(rope, cs_rope_retain(power), tree);
+    }
+    if (copies > 1) {
+      power = cs_rope_pair(rope, power, cs_rope_retain(power));
+    }
+  }
+  cs_rope_release(power);
+  
+  tree = cs_rope_join(
+    rope, 
+    tree, 
+    cs_rope_sub(rope, block, 0, total % unit)
+  );
+  cs_rope_release(block);
+  
+  return tree;
+}
+
+// In order walk over the leaves with an explicit stack
+typedef struct cs_ropeIter {
+  const cs_ropeNode *stack[CS_ROPE_DEPTH];
+  int depth;
+} cs_ropeIter;
+
+static void cs_ropeIter_start(cs_ropeIter *iter, const cs_ropeNode *root) {
+  iter->depth = 0;
+  if (root) {
+    iter->stack[iter->depth++] = root;
+  }
+}
+
+static const cs_ropeNode *cs_ropeIter_next(cs_ropeIter *iter) {
+  const cs_ropeNode *node;
+  
+  while (iter->depth) {
+    node = iter->stack[--iter->depth];
+    if (!node->height) {
+      return node;
+    }
+    iter->stack[iter->depth++] = node->right;
+    iter->stack[iter->depth++] = node->left;
+  }
+  
+  return 0L;
+}
+
+cs_rope *cs_rope_create(void) {
+  return cs_rope_createUsing(cs_globalAllocator);
+}
+
+cs_rope *cs_rope_createUsing(const cs_allocator *allocator) {
+  cs_rope *rope;
+  
+  if (!allocator) {
+    allocator = cs_globalAllocator;
+  }
+  
+  rope = (cs_rope *)allocator->allocate(allocator->context, sizeof(cs_rope));
+  if (!rope) {
+    return 0L;
+  }
+  
+  rope->allocator = allocator;
+  rope->root = 0L;
+  rope->failed = FALSE;
+  
+  return rope;
+}
+
+cs_rope *cssa_toRope(const StringAction *action) {
+  cs_rope *rope;
+  
+  if (!action) {
+    return 0L;
+  }
+  
+  rope = cs_rope_createUsing(cs_allocatorOf((StringAction *)action));
+  if (rope) {
+    rope->root = cs_rope_build(rope, action->string, action->length);
+  }
+  
+  return rope;
+}
+
+cs_rope *cs_rope_copy(const cs_rope *rope) {
+  cs_rope *copy;
+  
+  if (!rope) {
+    return 0L;
+  }
+  
+  copy = cs_rope_createUsing(rope->allocator);
+  if (copy) {
+    copy->root = cs_rope_retain(rope->root);
+    copy->failed = rope->failed;
+  }
+  
+  return copy;
+}
+
+void cs_rope_free(cs_rope *rope) {
+  if (!rope) {
+    return;
+  }
+  
+  cs_rope_release(rope->root);
+  rope->allocator->release(rope->allocator->context, rope, sizeof(cs_rope));
+}
+
+size_t cs_rope_length(const cs_rope *rope) {
+  return rope && rope->root ? rope->root->length : 0;
+}
+
+BOOL cs_rope_failed(const cs_rope *rope) {
+  return !rope || rope->failed;
+}
+
+char cs_rope_charAt(const cs_rope *rope, size_t index) {
+  const cs_ropeNode *node;
+  
+  if (index >= cs_rope_length(rope)) {
+    return '\0';
+  }
+  
+  node = rope->root;
+  while (node->height) {
+    if (index < node->left->length) {
+      node = node->left;
+    }
+    else {
+      index -= node->left->length;
+      node = node->right;
+    }
+  }
+  
+  return node->bytes[index];
+}
+
+cs_rope *cs_rope_append(cs_rope *rope, const char *bytes, size_t length) {
+  if (!rope || !bytes || !length) {
+    return rope;
+  }
+  
+  rope->root = cs_rope_join(
+    rope, 
+    rope->root, 
+    cs_rope_build(rope, bytes, length)
+  );
+  
+  return rope;
+}
+
+cs_rope *cs_rope_concat(cs_rope *rope, const char *string) {
+  return string ? cs_rope_append(rope, string, strlen(string)) : rope;
+}
+
+cs_rope *cs_rope_concatRope(cs_rope *rope, const cs_rope *other) {
+  if (!rope || !other) {
+    return rope;
+  }
+  
+  rope->root = cs_rope_join(rope, rope->root, cs_rope_retain(other->root));
+  
+  return rope;
+}
+
+cs_rope *cs_rope_prepend(cs_rope *rope, const char *bytes, size_t length) {
+  if (!rope || !bytes || !length) {
+    return rope;
+  }
+  
+  rope->root = cs_rope_join(
+    rope, 
+    cs_rope_build(rope, bytes, length), 
+    rope->root
+  );
+  
+  return rope;
+}
+
+cs_rope *cs_rope_padEndWith(
+  cs_rope *rope,
+  size_t length,
+  const char *padString
+) {
+  const char *padding = padString ? padString : CS_DEFAULT_PADSTRING;
+  
+  if (!rope || cs_rope_length(rope) >= length) {
+    return rope;
+  }
+  
+  rope->root = cs_rope_join(
+    rope,
+    rope->root,
+    cs_rope_fill(rope, padding, strlen(padding), length - cs_rope_length(rope))
+  );
+  
+  return rope;
+}
+
+cs_rope *cs_rope_padStartWith(
+  cs_rope *rope,
+  size_t length,
+  const char *padString
+) {
+  const char *padding = padString ? padString : CS_DEFAULT_PADSTRING;
+  
+  if (!rope || cs_rope_length(rope) >= length) {
+    return rope;
+  }
+  
+  rope->root = cs_rope_join(
+    rope,
+    cs_rope_fill(rope, padding, strlen(padding), length - cs_rope_length(rope)),
+    rope->root
+  );
+  
+  return rope;
+}
+
+cs_rope *cs_rope_slice(const cs_rope *rope, size_t start, size_t end) {
+  cs_rope *slice;
+  size_t length;
+  
+  if (!rope) {
+    return 0L;
+  }
+  
+  length = cs_rope_length(rope);
+  if (end > length) {
+    end = length;
+  }
+  
+  slice = cs_rope_createUsing(rope->allocator);
+  if (slice) {
+    slice->root = cs_rope_sub(slice, rope->root, start, end);
+  }
+  
+  return slice;
+}
+
+size_t cs_rope_indexOfBytes(
+  const cs_rope *rope,
+  const char *needle,
+  size_t needleLength
+) {
+  const cs_allocator *allocator;
+  const cs_ropeNode *leaf;
+  cs_ropeIter iter;
+  char stack[256];
+  char *window;
+  size_t keep;       // bytes of context carried across a leaf boundary
+  size_t carried;    // bytes currently carried, ending at `offset`
+  size_t offset;     // rope offset of the current leaf
+  size_t take;
+  size_t hit;
+  
+  if (!rope) {
+    return CS_NOT_FOUND;
+  }
+  
+  if (!needleLength) {
+    return 0;
+  }
+  
+  // The window holds the carried tail plus the head of the next leaf
+  keep = needleLength - 1;
+  window = stack;
+  allocator = rope->allocator;
+  if (2 * keep > sizeof(stack)) {
+    window = (char *)allocator->allocate(allocator->context, 2 * keep);
+    if (!window) {
+      return CS_NOT_FOUND;
+    }
+  }
+  
+  hit = CS_NOT_FOUND;
+  carried = 0;
+  offset = 0;
+  cs_ropeIter_start(&iter, rope->root);
+  while ((leaf = cs_ropeIter_next(&iter))) {
+    // Matches that start in earlier leaves and end in this one
+    if (carried) {
+      take = leaf->length < keep ? leaf->length : keep;
+      memcpy(window + carried, leaf->bytes, take);
+      hit = cs_search(window, carried + take, needle, needleLength);
+      if (hit != CS_NOT_FOUND && hit < carried) {
+        hit = offset - carried + hit;
+        break;
+      }
+    }
+    
+    hit = cs_search(leaf->bytes, leaf->length, needle, needleLength);
+    if (hit != CS_NOT_FOUND) {
+      hit += offset;
+      break;
+    }
+    
+    // Carry the last `keep` bytes of the text seen so far
+    if (leaf->length >= keep) {
+      memcpy(window, leaf->bytes + leaf->length - keep, keep);
+      carried = keep;
+    }
+    else {
+      take = carried + leaf->length > keep ? carried + leaf->length - keep : 0;
+      memmove(window, window + take, carried - take);
+      memcpy(window + carried - take, leaf->bytes, leaf->length);
+      carried = carried - take + leaf->length;
+    }
+    offset += leaf->length;
+  }
+  
+  if (window != stack) {
+    allocator->release(allocator->context, window, 2 * keep);
+  }
+  
+  return hit;
+}
+
+size_t cs_rope_indexOf(const cs_rope *rope, const char *needle) {
+  return cs_rope_indexOfBytes(rope, needle, strlen(needle));
+}
+
+BOOL cs_rope_includes(const cs_rope *rope, const char *needle) {
+  return cs_rope_indexOf(rope, needle) != CS_NOT_FOUND;
+}
+
+size_t cs_rope_writeInto(const cs_rope *rope, char *buffer, size_t capacity) {
+  const cs_ropeNode *leaf;
+  cs_ropeIter iter;
+  char *out = buffer;
+  
+  if (!rope || !buffer || capacity <= cs_rope_length(rope)) {
+    return CS_NOT_FOUND;
+  }
+  
+  cs_ropeIter_start(&iter, rope->root);
+  while ((leaf = cs_ropeIter_next(&iter))) {
+    memcpy(out, leaf->bytes, leaf->length);
+    out += leaf->length;
+  }
+  *out = '\0';
+  
+  return (size_t)(out - buffer);
+}
+
+StringAction *cs_rope_flatten(const cs_rope *rope) {
+  StringAction *result;
+  
+  if (!rope) {
+    return 0L;
+  }
+  
+  result = cs_newUsing(rope->allocator, cs_rope_length(rope) + 1);
+  if (!result || !result->string) {
+    return result;
+  }
+  
+  result->length = cs_rope_writeInto(rope, result->string, result->size);
+  
+  return result;
+}
+
+// 64-bit multiply-and-fold mixing in the style of wyhash
+static uint64_t cs_hashMix(uint64_t a, uint64_t b) {
+#ifdef __SIZEOF_INT128__
+  __uint128_t product = (__uint128_t)a * b;
+  return (uint64_t)product ^ (uint64_t)(product >> 64);
+#else
+  uint64_t product = a * b;
+  return product ^ (product >> 32) ^ ((a ^ b) >> 29);
+#endif
+}
+
+static uint64_t cs_read64(const char *bytes) {
+  uint64_t value;
+  memcpy(&value, bytes, sizeof(value));
+  return value;
+}
+
+static uint64_t cs_read32(const char *bytes) {
+  uint32_t value;
+  memcpy(&value, bytes, sizeof(value));
+  return value;
+}
+
+// Hash of arbitrary bytes; 16 bytes are folded per step and short inputs
+// are read with overlapping loads instead of a byte loop
+static uint64_t cs_hash64(const char *bytes, size_t length) {
+  const uint64_t p0 = 0xa0761d6478bd642fULL;
+  const uint64_t p1 = 0xe7037ed1a0b428dbULL;
+  const uint64_t p2 = 0x8ebc6af09c88c6e3ULL;
+  uint64_t seed = p0 ^ (uint64_t)length;
+  uint64_t a = 0;
+  uint64_t b = 0;
+  size_t rest = length;
+  
+  while (rest > 16) {
+    seed = cs_hashMix(cs_read64(bytes) ^ p1, cs_read64(bytes + 8) ^ seed);
+    bytes += 16;
+    rest -= 16;
+  }
+  
+  if (rest >= 8) {
+    a = cs_read64(bytes);
+    b = cs_read64(bytes + rest - 8);
+  }
+  else if (rest >= 4) {
+    a = cs_read32(bytes);
+    b = cs_read32(bytes + rest - 4);
+  }
+  else if (rest) {
+    a = ((uint64_t)(unsigned char)bytes[0] << 16) | 
+      ((uint64_t)(unsigned char)bytes[rest >> 1] << 8) | 
+      (unsigned char)bytes[rest - 1];
+  }
+  
+  return cs_hashMix(p2 ^ (uint64_t)length, cs_hashMix(a ^ p1, b ^ seed));
+}
+
+// Narrows a hash to size_t, keeping both halves on 32-bit targets; zero is
+// left free to mean "not cached"
+static size_t cs_foldHash(uint64_t hash) {
+  size_t folded;
+  
+  folded = sizeof(size_t) < sizeof(uint64_t) 
+    ? (size_t)(hash ^ (hash >> 32)) 
+    : (size_t)hash;
+  
+  return folded ? folded : 1;
+}
+
+size_t cs_hashBytes(const char *bytes, size_t length) {
+  return cs_foldHash(cs_hash64(bytes, length));
+}
+
+size_t cs_view_hash(cs_view string) {
+  return cs_hashBytes(string.ptr, string.len);
+}
+
+// The cached hash lives in `reserved`; it is read and written atomically
+// because shared and interned strings are hashed from several threads
+static size_t cs_cachedHash(const StringAction *action) {
+  return (size_t)(uintptr_t)__atomic_load_n(
+    &action->reserved, 
+    __ATOMIC_RELAXED
+  );
+}
+
+size_t cs_hash(const StringAction *action) {
+  size_t hash;
+  
+  if (!action || !action->string) {
+    return 0;
+  }
+  
+  hash = cs_cachedHash(action);
+  if (!hash) {
+    hash = cs_hashBytes(action->string, action->length);
+    __atomic_store_n(
+      &((StringAction *)action)->reserved, 
+      (void *)(uintptr_t)hash, 
+      __ATOMIC_RELAXED
+    );
+  }
+  
+  return hash;
+}
+
+BOOL cs_equals(const StringAction *a, const StringAction *b) {
+  size_t hashA, hashB;
+  
+  if (a == b) {
+    return TRUE;
+  }
+  
+  if (!a || !b || a->length != b->length) {
+    return FALSE;
+  }
+  
+  // Hashes that are already known settle most mismatches in O(1)
+  hashA = cs_cachedHash(a);
+  hashB = cs_cachedHash(b);
+  if (hashA && hashB && hashA != hashB) {
+    return FALSE;
+  }
+  
+  return memcmp(a->string, b->string, a->length) == 0;
+}
+
+int cs_compare(const StringAction *a, const StringAction *b) {
+  if (a == b) {
+    return 0;
+  }
+  
+  if (!a || !b) {
+    return a ? 1 : -1;
+  }
+  
+  return cs_view_compare(cssa_view(a), cssa_view(b));
+}
+
+// Interned strings are spread over independently locked shards picked by
+// the top hash bits; each shard is an open addressed table of hashes and
+// canonical StringActions. Entries live until the table is destroyed, which
+// lets every thread keep a small lock-free cache of recent lookups.
+#define CS_INTERN_SHARDS 64     // power of two
+#define CS_INTERN_CACHE 256     // per-thread cache slots, power of two
+#define CS_INTERN_MIN 64        // initial slots per shard
+
+typedef struct cs_internSlot {
+  uint64_t hash;
+  StringAction *value;  // 0L when the slot is free
+} cs_internSlot;
+
+typedef struct cs_internShard {
+  pthread_mutex_t lock;
+  cs_internSlot *slots;
+  size_t capacity;
+  size_t count;
+  char padding[64];     // keeps neighbouring locks off one cache line
+} cs_internShard;
+
+struct cs_internTable {
+  const cs_allocator *allocator;
+  size_t id;            // distinguishes tables in the thread caches
+  size_t requested;     // bytes of interned text, terminators included
+  size_t reserved;      // bytes held for strings and slot arrays
+  size_t peak;
+  size_t count;
+  cs_internShard shards[CS_INTERN_SHARDS];
+};
+
+typedef struct cs_internCached {
+  size_t id;            // table the entry belongs to
+  uint64_t hash;
+  StringAction *value;
+} cs_internCached;
+
+static size_t cs_internIds = 0;
+static __thread cs_internCached cs_internCache[CS_INTERN_CACHE];
+
+cs_internTable *cs_internTable_create(void) {
+  return cs_internTable_createUsing(cs_globalAllocator);
+}
+
+cs_internTable *cs_internTable_createUsing(const cs_allocator *allocator) {
+  cs_internTable *table;
+  size_t i;
+  
+  if (!allocator) {
+    allocator = cs_globalAllocator;
+  }
+  
+  table = (cs_internTable *)allocator->allocate(
+    allocator->context, 
+    sizeof(cs_internTable)
+  );
+  if (!table) {
+    return 0L;
+  }
+  
+  memset(table, 0L, sizeof(cs_internTable));
+  table->allocator = allocator;
+  table->id = __atomic_add_fetch(&cs_internIds, 1, __ATOMIC_RELAXED);
+  for (i = 0; i < CS_INTERN_SHARDS; i++) {
+    pthread_mutex_init(&table->shards[i].lock, 0L);
+  }
+  
+  return table;
+}
+
+void cs_internTable_destroy(cs_internTable *table) {
+  const cs_allocator *allocator;
+  cs_internShard *shard;
+  size_t i, j;
+  
+  if (!table) {
+    return;
+  }
+  
+  allocator = table->allocator;
+  for (i = 0; i < CS_INTERN_SHARDS; i++) {
+    shard = &table->shards[i];
+    for (j = 0; j < shard->capacity; j++) {
+      if (shard->slots[j].value) {
+        cs_free(shard->slots[j].value);
+      }
+    }
+    if (shard->slots) {
+      allocator->release(
+        allocator->context, 
+        shard->slots, 
+        shard->capacity * sizeof(cs_internSlot)
+      );
+    }
+    pthread_mutex_destroy(&shard->lock);
+  }
+  
+  allocator->release(allocator->context, table, sizeof(cs_internTable));
+}
+
+// Adds to the table totals; shards update them concurrently
+static void cs_internTable_account(
+  cs_internTable *table, 
+  size_t requested, 
+  size_t reserved,
+  size_t count
+) {
+  size_t total, peak;
+  
+  __atomic_add_fetch(&table->requested, requested, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&table->count, count, __ATOMIC_RELAXED);
+  total = __atomic_add_fetch(&table->reserved, reserved, __ATOMIC_RELAXED);
+  
+  peak = __atomic_load_n(&table->peak, __ATOMIC_RELAXED);
+  while (
+    total > peak && 
+    !__atomic_compare_exchange_n(
+      &table->peak, 
+      &peak, 
+      total, 
+      TRUE, 
+      __ATOMIC_RELAXED, 
+      __ATOMIC_RELAXED
+    )
+  ) {
+  }
+}
+
+// Doubles a shard's slot array; called with the shard locked
+static BOOL cs_internTable_grow(cs_internTable *table, cs_internShard *shard) {
+  const cs_allocator *allocator = table->allocator;
+  cs_internSlot *slots;
+  size_t capacity;
+  size_t i, j;
+  
+  capacity = shard->capacity ? shard->capacity * 2 : CS_INTERN_MIN;
+  slots = (cs_internSlot *)allocator->allocate(
+    allocator->context, 
+    capacity * sizeof(cs_internSlot)
+  );
+  if (!slots) {
+    return FALSE;
+  }
+  memset(slots, 0L, capacity * sizeof(cs_internSlot));
+  
+  for (i = 0; i < shard->capacity; i++) {
+    if (!shard->slots[i].value) {
+      continue;
+    }
+    j = (size_t)shard->slots[i].hash & (capacity - 1);
+    while (slots[j].value) {
+      j = (j + 1) & (capacity - 1);
+    }
+    slots[j] = shard->slots[i];
+  }
+  
+  if (shard->slots) {
+    allocator->release(
+      allocator->context, 
+      shard->slots, 
+      shard->capacity * sizeof(cs_internSlot)
+    );
+  }
+  cs_internTable_account(
+    table, 
+    0, 
+    (capacity - shard->capacity) * sizeof(cs_internSlot), 
+    0
+  );
+  
+  shard->slots = slots;
+  shard->capacity = capacity;
+  
+  return TRUE;
+}
+
+const StringAction *cs_internBytes(
+  cs_internTable *table,
+  const char *bytes,
+  size_t length
+) {
+  cs_internCached *cached;
+  cs_internShard *shard;
+  StringAction *value;
+  StringAction *found = 0L;
+  uint64_t hash;
+  size_t i;
+  
+  if (!table || !bytes) {
+    return 0L;
+  }
+  
+  hash = cs_hash64(bytes, length);
+  
+  // Entries are never removed, so a cached pointer stays valid for as long
+  // as its table lives
+  cached = &cs_internCache[hash & (CS_INTERN_CACHE - 1)];
+  value = cached->value;
+  if (
+    value &&
+    cached->id == table->id &&
+    cached->hash == hash &&
+    value->length == length &&
+    memcmp(value->string, bytes, length) == 0
+  ) {
+    return value;
+  }
+  
+  shard = &table->shards[hash >> 58 & (CS_INTERN_SHARDS - 1)];
+  pthread_mutex_lock(&shard->lock);
+  
+  if (
+    shard->count * 4 >= shard->capacity * 3 && 
+    !cs_internTable_grow(table, shard)
+  ) {
+    pthread_mutex_unlock(&shard->lock);
+    return 0L;
+  }
+  
+  i = (size_t)hash & (shard->capacity - 1);
+  while ((value = shard->slots[i].value)) {
+    if (
+      shard->slots[i].hash == hash &&
+      value->length == length &&
+      memcmp(value->string, bytes, length) == 0
+    ) {
+      found = value;
+      break;
+    }
+    i = (i + 1) & (shard->capacity - 1);
+  }
+  
+  // First sighting: the canonical copy is an ordinary cs_copy
+  if (!found) {
+    found = cs_copyBytesUsing(table->allocator, bytes, length, length + 1, 0L);
+    if (found && !cssa_test(found, CSSA_FAILED)) {
+      shard->slots[i].hash = hash;
+      shard->slots[i].value = found;
+      found->reserved = (void *)(uintptr_t)cs_foldHash(hash);
+      shard->count++;
+      cs_internTable_account(
+        table, 
+        length + 1, 
+        sizeof(StringAction) + 
+          (cssa_test(found, CSSA_INLINE) ? 0 : found->size),
+        1
+      );
+    }
+    else {
+      if (found) {
+        cs_free(found);
+      }
+      found = 0L;
+    }
+  }
+  
+  pthread_mutex_unlock(&shard->lock);
+  
+  if (found) {
+    cached->id = table->id;
+    cached->hash = hash;
+    cached->value = found;
+  }
+  
+  return found;
+}
+
+const StringAction *cs_intern(cs_internTable *table, const char *string) {
+  return string ? cs_internBytes(table, string, strlen(string)) : 0L;
+}
+
+const StringAction *cs_internView(cs_internTable *table, cs_view string) {
+  return cs_internBytes(table, string.ptr, string.len);
+}
+
+size_t cs_internTable_count(const cs_internTable *table) {
+  return table ? __atomic_load_n(&table->count, __ATOMIC_RELAXED) : 0;
+}
+
+void cs_internTable_stats(const cs_internTable *table, cs_allocStats *stats) {
+  if (!table || !stats) {
+    return;
+  }
+  
+  stats->requested = __atomic_load_n(&table->requested, __ATOMIC_RELAXED);
+  stats->reserved = __atomic_load_n(&table->reserved, __ATOMIC_RELAXED);
+  stats->blocks = __atomic_load_n(&table->count, __ATOMIC_RELAXED);
+  stats->peak = __atomic_load_n(&table->peak, __ATOMIC_RELAXED);
+}
+
+// Code point access. Counting and block skips test 16 bytes at a time for
+// continuation bytes; decoding and validation of multibyte runs are scalar.
+static BOOL cs_isContinuation(char byte) {
+  return ((unsigned char)byte & 0xC0) == 0x80;
+}
+
+// Counts code points as bytes that do not continue a sequence
+static size_t cs_countCodePoints(const char *bytes, size_t length) {
+  size_t count = 0;
+  size_t i = 0;
+  
+#if CS_X86_SIMD
+  // Continuation bytes, 0x80..0xBF, are exactly those below -64 as int8
+  const __m128i limit = _mm_set1_epi8(-64);
+  
+  for (; i + 16 <= length; i += 16) {
+    count += 16 - (size_t)__builtin_popcount((unsigned int)_mm_movemask_epi8(
+      _mm_cmplt_epi8(_mm_loadu_si128((const __m128i *)(bytes + i)), limit)
+    ));
+  }
+#endif
+  
+  for (; i < length; i++) {
+    count += !cs_isContinuation(bytes[i]);
+  }
+  
+  return count;
+}
+
+// Byte offset of code point `index`, or `length` when there are fewer;
+// whole 16-byte blocks are skipped by counting their lead bytes
+static size_t cs_codePointOffset(
+  const char *bytes, 
+  size_t length, 
+  size_t index
+) {
+  size_t i = 0;
+  size_t leads;
+  
+#if CS_X86_SIMD
+  const __m128i limit = _mm_set1_epi8(-64);
+  
+  for (; i + 16 <= length; i += 16) {
+    leads = 16 - (size_t)__builtin_popcount((unsigned int)_mm_movemask_epi8(
+      _mm_cmplt_epi8(_mm_loadu_si128((const __m128i *)(bytes + i)), limit)
+    ));
+    if (leads > index) {
+      break;
+    }
+    index -= leads;
+  }
+#else
+  (void)leads;
+#endif
+  
+  for (; i < length; i++) {
+    if (!cs_isContinuation(bytes[i])) {
+      if (!index) {
+        return i;
+      }
+      index--;
+    }
+  }
+  
+  return length;
+}
+
+// Decodes the sequence at `bytes`, returning the code point or -1 when it
+// is malformed, overlong, a surrogate or beyond U+10FFFF
+static int cs_decodeUTF8(const char *bytes, size_t available, size_t *used) {
+  const unsigned char *p = (const unsigned char *)bytes;
+  unsigned int codePoint;
+  size_t need, i;
+  
+  *used = 1;
+  if (p[0] < 0x80) {
+    return p[0];
+  }
+  
+  if (p[0] >= 0xC2 && p[0] <= 0xDF) {
+    need = 1;
+    codePoint = p[0] & 0x1F;
+  }
+  else if (p[0] >= 0xE0 && p[0] <= 0xEF) {
+    need = 2;
+    codePoint = p[0] & 0x0F;
+  }
+  else if (p[0] >= 0xF0 && p[0] <= 0xF4) {
+    need = 3;
+    codePoint = p[0] & 0x07;
+  }
+  else {
+    return -1;
+  }
+  
+  if (need >= available) {
+    return -1;
+  }
+  
+  for (i = 1; i <= need; i++) {
+    if ((p[i] & 0xC0) != 0x80) {
+      return -1;
+    }
+    codePoint = (codePoint << 6) | (p[i] & 0x3F);
+  }
+  
+  if (
+    (need == 2 && codePoint < 0x800) ||
+    (need == 3 && (codePoint < 0x10000 || codePoint > 0x10FFFF)) ||
+    (codePoint >= 0xD800 && codePoint <= 0xDFFF)
+  ) {
+    return -1;
+  }
+  
+  *used = need + 1;
+  return (int)codePoint;
+}
+
+BOOL cs_isValidUTF8(const char *bytes, size_t length) {
+  size_t i = 0;
+  size_t used;
+  
+  while (i < length) {
+#if CS_X86_SIMD
+    // ASCII runs are cleared 16 bytes at a time
+    if (
+      i + 16 <= length && 
+      !_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(bytes + i)))
+    ) {
+      i += 16;
+      continue;
+    }
+#endif
+    if (cs_decodeUTF8(bytes + i, length - i, &used) < 0) {
+      return FALSE;
+    }
+    i += used;
+  }
+  
+  return TRUE;
+}
+
+size_t cs_lengthCodePoints(const char *string) {
+  return cs_countCodePoints(string, strlen(string));
+}
+
+size_t cs_view_lengthCodePoints(cs_view string) {
+  return cs_countCodePoints(string.ptr, string.len);
+}
+
+int cs_codePointAt(const char *string, size_t index) {
+  size_t length = strlen(string);
+  size_t offset = cs_codePointOffset(string, length, index);
+  size_t used;
+  
+  return offset < length 
+    ? cs_decodeUTF8(string + offset, length - offset, &used) 
+    : -1;
+}
+
+// Builds the index in one pass, or returns 0L when the string is too short
+// to be worth one, lives inline, or memory runs out
+static cs_utf8Index *cs_utf8IndexBuild(StringAction *action) {
+  const cs_allocator *allocator = cs_allocatorOf(action);
+  cs_utf8Index *index;
+  size_t codePoints;
+  size_t count;
+  size_t offset;
+  size_t k;
+  
+  index = cs_utf8IndexOf(action);
+  if (index) {
+    return index;
+  }
+  
+  if (
+    action->length < CS_UTF8_INDEX_MIN || 
+    cssa_test(action, CSSA_INLINE)
+  ) {
+    return 0L;
+  }
+  
+  // Pure ASCII needs no offsets at all
+  codePoints = cs_countCodePoints(action->string, action->length);
+  count = codePoints == action->length 
+    ? 0 
+    : (codePoints + CS_UTF8_STRIDE - 1) / CS_UTF8_STRIDE;
+  
+  index = (cs_utf8Index *)allocator->allocate(
+    allocator->context, 
+    sizeof(cs_utf8Index) + count * sizeof(size_t)
+  );
+  if (!index) {
+    return 0L;
+  }
+  
+  index->codePoints = codePoints;
+  index->count = count;
+  offset = 0;
+  for (k = 0; k < count; k++) {
+    offset += cs_codePointOffset(
+      action->string + offset, 
+      action->length - offset, 
+      k ? CS_UTF8_STRIDE : 0
+    );
+    index->offsets[k] = offset;
+  }
+  
+  memcpy(action->buffer + CS_UTF8_SLOT, &index, sizeof(cs_utf8Index *));
+  action->lastAction |= CSSA_INDEXED;
+  
+  return index;
+}
+
+size_t cssa_lengthCodePoints(StringAction *action) {
+  cs_utf8Index *index;
+  
+  if (!action || !action->string) {
+    return 0;
+  }
+  
+  index = cs_utf8IndexBuild(action);
+  
+  return index 
+    ? index->codePoints 
+    : cs_countCodePoints(action->string, action->length);
+}
+
+int cssa_codePointAt(StringAction *action, size_t codePoint) {
+  cs_utf8Index *index;
+  size_t offset;
+  size_t used;
+  
+  if (!action || !action->string) {
+    return -1;
+  }
+  
+  index = cs_utf8IndexBuild(action);
+  if (!index) {
+    offset = cs_codePointOffset(action->string, action->length, codePoint);
+  }
+  else if (codePoint >= index->codePoints) {
+    return -1;
+  }
+  else if (!index->count) {
+    offset = codePoint;
+  }
+  else {
+    offset = index->offsets[codePoint / CS_UTF8_STRIDE];
+    offset += cs_codePointOffset(
+      action->string + offset, 
+      action->length - offset, 
+      codePoint % CS_UTF8_STRIDE
+    );
+  }
+  
+  return offset < action->length 
+    ? cs_decodeUTF8(action->string + offset, action->length - offset, &used) 
+    : -1;
+}
+
+// Bytes that pad `have` code points up to `length` with whole code points
+// of the pattern, as the byte-based padding functions then lay them out
+static size_t cs_padBytesFor(
+  size_t have, 
+  size_t length, 
+  const char *padding
+) {
+  size_t patternBytes = strlen(padding);
+  size_t patternPoints = cs_countCodePoints(padding, patternBytes);
+  size_t need;
+  
+  if (have >= length || !patternPoints) {
+    return 0;
+  }
+  
+  need = length - have;
+  return (need / patternPoints) * patternBytes + 
+    cs_codePointOffset(padding, patternBytes, need % patternPoints);
+}
+
+char *cssa_padEndCodePoints(
+  StringAction *action,
+  size_t length,
+  const char *padString
+) {
+  const char *padding = padString ? padString : CS_DEFAULT_PADSTRING;
+  size_t bytes;
+  
+  if (!action || !action->string) {
+    return 0L;
+  }
+  
+  bytes = cs_padBytesFor(cssa_lengthCodePoints(action), length, padding);
+  if (!bytes) {
+    action->lastAction |= CSSA_SKIPPED;
+    return action->string;
+  }
+  
+  return cssa_padEndWith(action, action->length + bytes, padding);
+}
+
+char *cssa_padStartCodePoints(
+  StringAction *action,
+  size_t length,
+  const char *padString
+) {
+  const char *padding = padString ? padString : CS_DEFAULT_PADSTRING;
+  size_t bytes;
+  
+  if (!action || !action->string) {
+    return 0L;
+  }
+  
+  bytes = cs_padBytesFor(cssa_lengthCodePoints(action), length, padding);
+  if (!bytes) {
+    action->lastAction |= CSSA_SKIPPED;
+    return action->string;
+  }
+  
+  return cssa_padStartWith(action, action->length + bytes, padding);
+}
+
+char *cs_padEndCodePoints(char *string, size_t length, const char *padString) {
+  StringAction sa;
+  cs_heapAction(&sa, string);
+  cssa_padEndCodePoints(&sa, length, padString);
+  
+  // Counting may have cached an index on the temporary wrapper
+  cs_utf8IndexRelease(&sa);
+  return sa.string;
+}
+
+char *cs_padStartCodePoints(
+  char *string, 
+  size_t length, 
+  const char *padString
+) {
+  StringAction sa;
+  cs_heapAction(&sa, string);
+  cssa_padStartCodePoints(&sa, length, padString);
+  
+  // Counting may have cached an index on the temporary wrapper
+  cs_utf8IndexRelease(&sa);
+  return sa.string;
+}
+
+// ASCII case mapping, whitespace trimming and case-insensitive search.
+// Bytes outside A-Z/a-z, including UTF-8 sequences, are left untouched.
+// The kernels fold 16 bytes per step with SSE2, which every x86-64 CPU has.
+
+static char cs_lowerByte(char byte) {
+  return byte >= 'A' && byte <= 'Z' ? (char)(byte | 0x20) : byte;
+}
+
+static char cs_upperByte(char byte) {
+  return byte >= 'a' && byte <= 'z' ? (char)(byte & ~0x20) : byte;
+}
+
+static BOOL cs_isSpaceByte(char byte) {
+  return byte == ' ' || (byte >= '\t' && byte <= '\r');
+}
+
+#if CS_X86_SIMD
+// Flips the case bit of the letters from `first` to `first` + 25; adding
+// 0x80 - first moves that range onto the 26 smallest signed bytes
+static __m128i cs_flipCase16(__m128i block, char first) {
+  __m128i shifted = _mm_add_epi8(block, _mm_set1_epi8((char)(0x80 - first)));
+  __m128i letters = _mm_cmplt_epi8(shifted, _mm_set1_epi8((char)(0x80 + 26)));
+  
+  return _mm_xor_si128(block, _mm_and_si128(letters, _mm_set1_epi8(0x20)));
+}
+
+// Space, \t, \n, \v, \f and \r
+static unsigned int cs_spaceMask16(__m128i block) {
+  __m128i shifted = _mm_add_epi8(block, _mm_set1_epi8((char)(0x80 - '\t')));
+  
+  return (unsigned int)_mm_movemask_epi8(_mm_or_si128(
+    _mm_cmpeq_epi8(block, _mm_set1_epi8(' ')),
+    _mm_cmplt_epi8(shifted, _mm_set1_epi8((char)(0x80 + 5)))
+  ));
+}
+#endif
+
+// Copies `length` bytes with A-Z lowered, or a-z raised; `dest` may be `src`
+static void cs_mapCase(char *dest, const char *src, size_t length, BOOL upper) {
+  size_t i = 0;
+  
+#if CS_X86_SIMD
+  char first = upper ? 'a' : 'A';
+  
+  for (; i + 16 <= length; i += 16) {
+    _mm_storeu_si128((__m128i *)(dest + i), cs_flipCase16(
+      _mm_loadu_si128((const __m128i *)(src + i)), 
+      first
+    ));
+  }
+#endif
+  
+  for (; i < length; i++) {
+    dest[i] = upper ? cs_upperByte(src[i]) : cs_lowerByte(src[i]);
+  }
+}
+
+// Leading whitespace bytes
+static size_t cs_spaceBefore(const char *bytes, size_t length) {
+  size_t i = 0;
+  
+#if CS_X86_SIMD
+  unsigned int mask;
+  
+  for (; i + 16 <= length; i += 16) {
+    mask = ~cs_spaceMask16(_mm_loadu_si128((const __m128i *)(bytes + i)));
+    if (mask & 0xFFFF) {
+      return i + (size_t)__builtin_ctz(mask);
+    }
+  }
+#endif
+  
+  while (i < length && cs_isSpaceByte(bytes[i])) {
+    i++;
+  }
+  
+  return i;
+}
+
+// Length once trailing whitespace is dropped
+static size_t cs_spaceAfter(const char *bytes, size_t length) {
+#if CS_X86_SIMD
+  unsigned int mask;
+  
+  for (; length >= 16; length -= 16) {
+    mask = ~cs_spaceMask16(
+      _mm_loadu_si128((const __m128i *)(bytes + length - 16))
+    ) & 0xFFFF;
+    if (mask) {
+      return length - 16 + 32 - (size_t)__builtin_clz(mask);
+    }
+  }
+#endif
+  
+  while (length && cs_isSpaceByte(bytes[length - 1])) {
+    length--;
+  }
+  
+  return length;
+}
+
+// Whether two runs of `length` bytes match ignoring ASCII case
+static BOOL cs_equalsFold(const char *a, const char *b, size_t length) {
+  size_t i = 0;
+  
+#if CS_X86_SIMD
+  for (; i + 16 <= length; i += 16) {
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(
+      cs_flipCase16(_mm_loadu_si128((const __m128i *)(a + i)), 'A'),
+      cs_flipCase16(_mm_loadu_si128((const __m128i *)(b + i)), 'A')
+    )) != 0xFFFF) {
+      return FALSE;
+    }
+  }
+#endif
+  
+  for (; i < length; i++) {
+    if (cs_lowerByte(a[i]) != cs_lowerByte(b[i])) {
+      return FALSE;
+    }
+  }
+  
+  return TRUE;
+}
+
+size_t cs_searchCI(
+  const char *haystack,
+  size_t haystackLength,
+  const char *needle,
+  size_t needleLength
+) {
+  size_t last = needleLength - 1;
+  char first;
+  char final;
+  size_t i = 0;
+  
+  if (needleLength == 0) {
+    return 0;
+  }
+  
+  if (needleLength > haystackLength) {
+    return CS_NOT_FOUND;
+  }
+  
+  // The needle's first and last bytes, folded, filter the windows just as
+  // in cs_search; candidates are verified with a folding compare
+  first = cs_lowerByte(needle[0]);
+  final = cs_lowerByte(needle[last]);
+  
+#if CS_X86_SIMD
+  {
+    const __m128i probe1 = _mm_set1_epi8(first);
+    const __m128i probe2 = _mm_set1_epi8(final);
+    unsigned int mask;
+    unsigned int bit;
+    
+    for (; i + last + 16 <= haystackLength; i += 16) {
+      const char *block = haystack + i;
+      
+      mask = (unsigned int)_mm_movemask_epi8(_mm_and_si128(
+        _mm_cmpeq_epi8(probe1, cs_flipCase16(
+          _mm_loadu_si128((const __m128i *)block), 
+          'A'
+        )),
+        _mm_cmpeq_epi8(probe2, cs_flipCase16(
+          _mm_loadu_si128((const __m128i *)(block + last)), 
+          'A'
+        ))
+      ));
+      
+      while (mask) {
+        bit = (unsigned int)__builtin_ctz(mask);
+        if (cs_equalsFold(block + bit, needle, needleLength)) {
+          return i + bit;
+        }
+        mask &= mask - 1;
+      }
+    }
+  }
+#endif
+  
+  for (; i + last < haystackLength; i++) {
+    if (
+      cs_lowerByte(haystack[i]) == first &&
+      cs_lowerByte(haystack[i + last]) == final &&
+      cs_equalsFold(haystack + i, needle, needleLength)
+    ) {
+      return i;
+    }
+  }
+  
+  return CS_NOT_FOUND;
+}
+
+size_t cs_indexOfCI(const char *haystack, const char *needle) {
+  return cs_searchCI(haystack, strlen(haystack), needle, strlen(needle));
+}
+
+BOOL cs_includesCI(const char *haystack, const char *needle) {
+  return cs_indexOfCI(haystack, needle) != CS_NOT_FOUND;
+}
+
+BOOL cs_endsWithCI(const char *string, const char *ending) {
+  return cs_view_endsWithCI(cs_viewOf(string), cs_viewOf(ending));
+}
+
+size_t cs_view_indexOfCI(cs_view haystack, cs_view needle) {
+  return cs_searchCI(haystack.ptr, haystack.len, needle.ptr, needle.len);
+}
+
+BOOL cs_view_includesCI(cs_view haystack, cs_view needle) {
+  return cs_view_indexOfCI(haystack, needle) != CS_NOT_FOUND;
+}
+
+BOOL cs_view_endsWithCI(cs_view string, cs_view ending) {
+  return ending.len <= string.len && cs_equalsFold(
+    string.ptr + string.len - ending.len, 
+    ending.ptr, 
+    ending.len
+  );
+}
+
+BOOL cs_view_equalsCI(cs_view a, cs_view b) {
+  return a.len == b.len && cs_equalsFold(a.ptr, b.ptr, a.len);
+}
+
+char *cs_toLower(char *string) {
+  cs_mapCase(string, string, strlen(string), FALSE);
+  return string;
+}
+
+char *cs_toUpper(char *string) {
+  cs_mapCase(string, string, strlen(string), TRUE);
+  return string;
+}
+
+size_t cs_toLowerInto(
+  const char *string, 
+  size_t length, 
+  char *buffer, 
+  size_t capacity
+) {
+  if (!buffer || capacity < length + 1) {
+    return CS_NOT_FOUND;
+  }
+  
+  cs_mapCase(buffer, string, length, FALSE);
+  buffer[length] = '\0';
+  
+  return length;
+}
+
+size_t cs_toUpperInto(
+  const char *string, 
+  size_t length, 
+  char *buffer, 
+  size_t capacity
+) {
+  if (!buffer || capacity < length + 1) {
+    return CS_NOT_FOUND;
+  }
+  
+  cs_mapCase(buffer, string, length, TRUE);
+  buffer[length] = '\0';
+  
+  return length;
+}
+
+static char *cssa_mapCase(StringAction *action, BOOL upper) {
+  if (!action || !action->string) {
+    return 0L;
+  }
+  
+  if (cssa_test(cssa_makeWritable(action), CS_READONLY)) {
+    fprintf(stderr, "Could not allocate memory!");
+    return action->string;
+  }
+  
+  cs_mapCase(action->string, action->string, action->length, upper);
+  
+  return action->string;
+}
+
+char *cssa_toLower(StringAction *action) {
+  return cssa_mapCase(action, FALSE);
+}
+
+char *cssa_toUpper(StringAction *action) {
+  return cssa_mapCase(action, TRUE);
+}
+
+cs_view cs_view_trim(cs_view string) {
+  return cs_view_trimEnd(cs_view_trimStart(string));
+}
+
+cs_view cs_view_trimStart(cs_view string) {
+  size_t skip = cs_spaceBefore(string.ptr, string.len);
+  
+  string.ptr += skip;
+  string.len -= skip;
+  
+  return string;
+}
+
+cs_view cs_view_trimEnd(cs_view string) {
+  string.len = cs_spaceAfter(string.ptr, string.len);
+  return string;
+}
+
+// Narrows an action to [start, end). Slices just move their window; other
+// buffers are made writable and the kept bytes slid to the front.
+static char *cssa_narrow(StringAction *action, size_t start, size_t end) {
+  if (start == 0 && end == action->length) {
+    action->lastAction |= CSSA_SKIPPED;
+    return action->string;
+  }
+  
+  if (cssa_test(action, CSSA_SLICE)) {
+    action->reserved = 0L;
+    cs_utf8IndexRelease(action);
+    action->string += start;
+    action->length = end - start;
+    action->size = action->length;
+    return action->string;
+  }
+  
+  if (cssa_test(cssa_makeWritable(action), CS_READONLY)) {
+    fprintf(stderr, "Could not allocate memory!");
+    return action->string;
+  }
+  
+  memmove(action->string, action->string + start, end - start);
+  action->string[end - start] = '\0';
+  action->length = end - start;
+  
+  return action->string;
+}
+
+char *cssa_trim(StringAction *action) {
+  size_t start;
+  
+  if (!action || !action->string) {
+    return 0L;
+  }
+  
+  start = cs_spaceBefore(action->string, action->length);
+  return cssa_narrow(
+    action, 
+    start, 
+    start + cs_spaceAfter(action->string + start, action->length - start)
+  );
+}
+
+char *cssa_trimStart(StringAction *action) {
+  if (!action || !action->string) {
+    return 0L;
+  }
+  
+  return cssa_narrow(
+    action, 
+    cs_spaceBefore(action->string, action->length), 
+    action->length
+  );
+}
+
+char *cssa_trimEnd(StringAction *action) {
+  if (!action || !action->string) {
+    return 0L;
+  }
+  
+  return cssa_narrow(
+    action, 
+    0, 
+    cs_spaceAfter(action->string, action->length)
+  );
+}
+
+char *cs_trim(char *string) {
+  StringAction sa;
+  cs_heapAction(&sa, string);
+  return cssa_trim(&sa);
+}
+
+char *cs_trimStart(char *string) {
+  StringAction sa;
+  cs_heapAction(&sa, string);
+  return cssa_trimStart(&sa);
+}
+
+char *cs_trimEnd(char *string) {
+  StringAction sa;
+  cs_heapAction(&sa, string);
+  return cssa_trimEnd(&sa);
+}
+
+// Mapped files and chunked readers
+
+StringAction *cs_mapFile(const char *path) {
+  return cs_mapFileUsing(cs_globalAllocator, path);
+}
+
+StringAction *cs_mapFileUsing(const cs_allocator *allocator, const char *path) {
+  StringAction *action;
+  struct stat info;
+  size_t page;
+  size_t mapped;
+  char *base;
+  int fd;
+  
+  if (!allocator) {
+    allocator = cs_globalAllocator;
+  }
+  
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return 0L;
+  }
+  
+  if (fstat(fd, &info) < 0) {
+    close(fd);
+    return 0L;
+  }
+  
+  // Pipes and devices have no size to map; read them with a cs_reader
+  if (!S_ISREG(info.st_mode)) {
+    close(fd);
+    errno = EINVAL;
+    return 0L;
+  }
+  
+  // Nothing to map; an empty string behaves the same
+  if (!info.st_size) {
+    close(fd);
+    return cs_copyUsing(allocator, CS_EMPTY_STRING);
+  }
+  
+  // The file is mapped over an anonymous reservation with at least one
+  // byte to spare, so a zeroed page always terminates it
+  page = (size_t)sysconf(_SC_PAGESIZE);
+  mapped = ((size_t)info.st_size + page) & ~(page - 1);
+  base = (char *)mmap(
+    0L, 
+    mapped, 
+    PROT_READ, 
+    MAP_PRIVATE | MAP_ANONYMOUS, 
+    -1, 
+    0
+  );
+  if (base == MAP_FAILED) {
+    close(fd);
+    return 0L;
+  }
   
-  if (times == 0) {
-    return strdup(CS_EMPTY_STRING);
+  if (mmap(
+    base, 
+    (size_t)info.st_size, 
+    PROT_READ, 
+    MAP_PRIVATE | MAP_FIXED, 
+    fd, 
+    0
+  ) == MAP_FAILED) {
+    munmap(base, mapped);
+    close(fd);
+    return 0L;
   }
+  close(fd);
   
+  action = (StringAction *)allocator->allocate(
+    allocator->context, 
+    sizeof(StringAction)
+  );
   if (!action) {
-    return NULL;
+    munmap(base, mapped);
+    errno = ENOMEM;
+    return 0L;
+  }
+  
+  memset(action, 0L, sizeof(StringAction));
+  action->string = base;
+  action->length = (size_t)info.st_size;
+  action->size = mapped;
+  action->lastAction = CSSA_NEW | CSSA_MAPPED;
+  action->allocator = allocator;
+  
+  return action;
+}
+
+// Bytes a reader asks of each read unless told otherwise
+#define CS_READ_CHUNK 262144
+
+struct cs_reader {
+  const cs_allocator *allocator;
+  int fd;
+  BOOL ownsFd;          // close fd in cs_reader_free
+  char *buffer;
+  size_t capacity;      // bytes allocated for buffer
+  size_t chunkSize;     // bytes asked of each read
+  size_t start;         // first byte of buffer not yet handed out
+  size_t length;        // bytes held in buffer
+  size_t offset;        // stream offset of buffer[0]
+  size_t chunkOffset;   // stream offset of the last chunk handed out
+  cs_matcher *matcher;  // search state for the last needle, or 0L
+  size_t matchBase;     // stream offset of the matcher's offset 0
+  BOOL eof;
+  BOOL failed;          // a read or an allocation failed
+};
+
+static BOOL cs_matcher_isFor(
+  const cs_matcher *matcher, 
+  const char *needle, 
+  size_t length
+);
+
+cs_reader *cs_reader_open(const char *path) {
+  cs_reader *reader;
+  int fd;
+  
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return 0L;
   }
   
-  buffer = (char *)malloc(action->size * times);
-  memset(buffer, 0L, action->size * times);
-  for (i = 0; i < times; i++) {
-    strcat(buffer, action->string);
+  reader = cs_reader_openUsing(cs_globalAllocator, fd, 0);
+  if (!reader) {
+    close(fd);
+    return 0L;
   }
   
-  return buffer;
-}
\ No newline at end of file
+  reader->ownsFd = TRUE;
+  return reader;
+}
+
+cs_reader *cs_reader_openFd(int fd) {
+  return cs_reader_openUsing(cs_globalAllocator, fd, 0);
+}
+
+cs_reader *cs_reader_openUsing(
+  const cs_allocator *allocator, 
+  int fd, 
+  size_t chunkSize
+) {
+  cs_reader *reader;
+  
+  if (!allocator) {
+    allocator = cs_globalAllocator;
+  }
+  
+  reader = (cs_reader *)allocator->allocate(
+    allocator->context, 
+    sizeof(cs_reader)
+  );
+  if (!reader) {
+    return 0L;
+  }
+  
+  memset(reader, 0L, sizeof(cs_reader));
+  reader->allocator = allocator;
+  reader->fd = fd;
+  reader->chunkSize = chunkSize ? chunkSize : CS_READ_CHUNK;
+  
+  return reader;
+}
+
+void cs_reader_free(cs_reader *reader) {
+  const cs_allocator *allocator;
+  
+  if (!reader) {
+    return;
+  }
+  
+  allocator = reader->allocator;
+  if (reader->buffer) {
+    allocator->release(allocator->context, reader->buffer, reader->capacity);
+  }
+  if (reader->ownsFd) {
+    close(reader->fd);
+  }
+  cs_matcher_free(reader->matcher);
+  
+  allocator->release(allocator->context, reader, sizeof(cs_reader));
+}
+
+BOOL cs_reader_failed(const cs_reader *reader) {
+  return !reader || reader->failed;
+}
+
+size_t cs_reader_offset(const cs_reader *reader) {
+  return reader ? reader->chunkOffset : 0;
+}
+
+// Drops what precedes `keep` bytes before the end of the buffer, then
+// appends up to one chunk from the descriptor. Returns FALSE once nothing
+// more can be read.
+static BOOL cs_reader_fill(cs_reader *reader, size_t keep) {
+  const cs_allocator *allocator = reader->allocator;
+  size_t drop = reader->length - keep;
+  size_t needed;
+  size_t grown;
+  ssize_t got;
+  char *newbuf;
+  
+  if (reader->eof || reader->failed) {
+    return FALSE;
+  }
+  
+  if (keep) {
+    memmove(reader->buffer, reader->buffer + drop, keep);
+  }
+  reader->start = reader->start > drop ? reader->start - drop : 0;
+  reader->length = keep;
+  reader->offset += drop;
+  
+  needed = keep + reader->chunkSize;
+  if (needed > reader->capacity) {
+    grown = reader->capacity ? reader->capacity : CS_MIN_CAPACITY;
+    while (grown < needed) {
+      grown *= 2;
+    }
+    newbuf = (char *)allocator->reallocate(
+      allocator->context, 
+      reader->buffer, 
+      reader->capacity, 
+      grown
+    );
+    if (!newbuf) {
+      reader->failed = TRUE;
+      return FALSE;
+    }
+    reader->buffer = newbuf;
+    reader->capacity = grown;
+  }
+  
+  do {
+    got = read(reader->fd, reader->buffer + keep, reader->chunkSize);
+  } while (got < 0 && errno == EINTR);
+  
+  if (got <= 0) {
+    reader->eof = TRUE;
+    reader->failed = got < 0;
+    return FALSE;
+  }
+  
+  reader->length += (size_t)got;
+  return TRUE;
+}
+
+BOOL cs_reader_next(cs_reader *reader, cs_view *chunk) {
+  if (!reader) {
+    return FALSE;
+  }
+  
+  // Bytes a search read ahead are handed out before reading any more
+  if (reader->start == reader->length && !cs_reader_fill(reader, 0)) {
+    return FALSE;
+  }
+  
+  chunk->ptr = reader->buffer + reader->start;
+  chunk->len = reader->length - reader->start;
+  reader->chunkOffset = reader->offset + reader->start;
+  reader->start = reader->length;
+  
+  // Searches resume after the bytes handed out, not inside them
+  if (reader->matcher) {
+    cs_matcher_reset(reader->matcher);
+    reader->matchBase = reader->offset + reader->length;
+  }
+  
+  return TRUE;
+}
+
+size_t cs_reader_indexOfBytes(
+  cs_reader *reader, 
+  const char *needle, 
+  size_t needleLength
+) {
+  size_t position;
+  size_t found;
+  size_t fed;
+  size_t keep;
+  size_t hit;
+  
+  if (!reader) {
+    return CS_NOT_FOUND;
+  }
+  
+  // The matcher carries on from the last search for the same needle
+  position = reader->offset + reader->start;
+  if (!cs_matcher_isFor(reader->matcher, needle, needleLength)) {
+    cs_matcher_free(reader->matcher);
+    reader->matcher = cs_matcher_createBytes(needle, needleLength);
+    reader->matchBase = position;
+    if (!reader->matcher) {
+      reader->failed = TRUE;
+      return CS_NOT_FOUND;
+    }
+  }
+  
+  for (;;) {
+    fed = reader->matchBase + cs_matcher_offset(reader->matcher);
+    found = cs_matcher_feed(
+      reader->matcher, 
+      reader->buffer + (fed - reader->offset), 
+      reader->offset + reader->length - fed, 
+      &hit, 
+      1
+    );
+    if (found) {
+      hit += reader->matchBase;
+      
+      // Later matches in bytes already fed are found again from one byte
+      // in, so overlapping hits count
+      if (found > 1) {
+        cs_matcher_reset(reader->matcher);
+        reader->matchBase = hit + 1;
+      }
+      
+      reader->start = hit + (needleLength ? 1 : 0) - reader->offset;
+      reader->chunkOffset = hit;
+      return hit;
+    }
+    
+    // The buffer keeps the bytes the matcher carries, so a match that
+    // began in them can still be handed out from its second byte
+    keep = reader->offset + reader->length - position;
+    if (keep > (needleLength ? needleLength - 1 : 0)) {
+      keep = needleLength ? needleLength - 1 : 0;
+    }
+    reader->start = reader->length - keep;
+    position = reader->offset + reader->start;
+    if (!cs_reader_fill(reader, keep)) {
+      return CS_NOT_FOUND;
+    }
+  }
+}
+
+size_t cs_reader_indexOf(cs_reader *reader, const char *needle) {
+  return cs_reader_indexOfBytes(reader, needle, strlen(needle));
+}
+
+BOOL cs_reader_includes(cs_reader *reader, const char *needle) {
+  return cs_reader_indexOf(reader, needle) != CS_NOT_FOUND;
+}
+
+// Streaming matches
+
+struct cs_matcher {
+  const cs_allocator *allocator; // where the matcher was allocated
+  cs_pattern *pattern;  // compiled needle, searched with cs_pattern_search
+  size_t consumed;      // stream offset just past the last byte fed
+  size_t carry;         // bytes at the front of window, the stream's tail
+  BOOL matchedEmpty;    // an empty needle has reported its one match
+  char window[];        // carry, then up to length - 1 bytes of a chunk
+};
+
+cs_matcher *cs_matcher_create(const char *needle) {
+  return cs_matcher_createBytes(needle, strlen(needle));
+}
+
+cs_matcher *cs_matcher_createBytes(const char *needle, size_t length) {
+  const cs_allocator *allocator = cs_globalAllocator;
+  size_t tail = length ? length - 1 : 0;
+  cs_matcher *matcher;
+  
+  if (tail > ((size_t)-1 - sizeof(cs_matcher)) / 2) {
+    return 0L;
+  }
+  
+  matcher = (cs_matcher *)allocator->allocate(
+    allocator->context, 
+    sizeof(cs_matcher) + 2 * tail
+  );
+  if (!matcher) {
+    return 0L;
+  }
+  
+  memset(matcher, 0L, sizeof(cs_matcher));
+  matcher->allocator = allocator;
+  matcher->pattern = cs_pattern_compileBytes(needle, length);
+  if (!matcher->pattern) {
+    allocator->release(
+      allocator->context, 
+      matcher, 
+      sizeof(cs_matcher) + 2 * tail
+    );
+    return 0L;
+  }
+  
+  return matcher;
+}
+
+void cs_matcher_free(cs_matcher *matcher) {
+  const cs_allocator *allocator;
+  size_t length;
+  
+  if (!matcher) {
+    return;
+  }
+  
+  allocator = matcher->allocator;
+  length = cs_pattern_length(matcher->pattern);
+  cs_pattern_free(matcher->pattern);
+  allocator->release(
+    allocator->context, 
+    matcher, 
+    sizeof(cs_matcher) + 2 * (length ? length - 1 : 0)
+  );
+}
+
+void cs_matcher_reset(cs_matcher *matcher) {
+  if (matcher) {
+    matcher->consumed = 0;
+    matcher->carry = 0;
+    matcher->matchedEmpty = FALSE;
+  }
+}
+
+size_t cs_matcher_offset(const cs_matcher *matcher) {
+  return matcher ? matcher->consumed : 0;
+}
+
+// TRUE when the matcher was created for this needle
+static BOOL cs_matcher_isFor(
+  const cs_matcher *matcher, 
+  const char *needle, 
+  size_t length
+) {
+  return matcher 
+    && matcher->pattern->length == length 
+    && memcmp(matcher->pattern->needle, needle, length) == 0;
+}
+
+size_t cs_matcher_feed(
+  cs_matcher *matcher,
+  const char *chunk,
+  size_t length,
+  size_t *offsets,
+  size_t capacity
+) {
+  size_t needleLength;
+  size_t tail;
+  size_t windowLength;
+  size_t found = 0;
+  size_t at;
+  size_t hit;
+  size_t keep;
+  
+  if (!matcher) {
+    return 0;
+  }
+  
+  needleLength = cs_pattern_length(matcher->pattern);
+  if (!needleLength) {
+    if (!matcher->matchedEmpty) {
+      matcher->matchedEmpty = TRUE;
+      if (capacity) {
+        offsets[0] = 0;
+      }
+      found = 1;
+    }
+    matcher->consumed += length;
+    return found;
+  }
+  if (!length) {
+    return 0;
+  }
+  tail = needleLength - 1;
+  
+  // Matches straddling the boundary start in the carry and end within the
+  // first needleLength - 1 bytes of the chunk
+  if (matcher->carry) {
+    windowLength = matcher->carry + (length < tail ? length : tail);
+    memcpy(
+      matcher->window + matcher->carry, 
+      chunk, 
+      windowLength - matcher->carry
+    );
+    
+    for (at = 0; at < matcher->carry; at += hit + 1) {
+      hit = cs_pattern_search(
+        matcher->pattern, 
+        matcher->window + at, 
+        windowLength - at
+      );
+      if (hit == CS_NOT_FOUND || at + hit >= matcher->carry) {
+        break;
+      }
+      if (found < capacity) {
+        offsets[found] = matcher->consumed - matcher->carry + at + hit;
+      }
+      found++;
+    }
+  }
+  
+  // Matches wholly inside the chunk
+  for (at = 0; at < length; at += hit + 1) {
+    hit = cs_pattern_search(matcher->pattern, chunk + at, length - at);
+    if (hit == CS_NOT_FOUND) {
+      break;
+    }
+    if (found < capacity) {
+      offsets[found] = matcher->consumed + at + hit;
+    }
+    found++;
+  }
+  
+  // Keep the last needleLength - 1 bytes of the stream for the next chunk
+  if (length >= tail) {
+    memcpy(matcher->window, chunk + length - tail, tail);
+    matcher->carry = tail;
+  }
+  else {
+    keep = matcher->carry < tail - length ? matcher->carry : tail - length;
+    memmove(
+      matcher->window, 
+      matcher->window + matcher->carry - keep, 
+      keep
+    );
+    memcpy(matcher->window + keep, chunk, length);
+    matcher->carry = keep + length;
+  }
+  
+  matcher->consumed += length;
+  return found;
+}
@@ -5,6 +5,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <sys/types.h>
 
 #ifndef BOOL
 #define BOOL short
@@ -18,9 +19,15 @@
 #define FALSE 0
 #endif
 
+// Index returned by the search functions when there is no match
+#define CS_NOT_FOUND ((size_t)-1)
+
 // Default string padding
 extern const char CS_DEFAULT_PADSTRING[];
 
+// Default separator for cs_join, as in JavaScript's Array.join
+extern const char CS_DEFAULT_SEPARATOR[];
+
 // Empty string constant
 extern const char CS_EMPTY_STRING[]; 
 
@@ -38,16 +45,82 @@ extern const size_t CSSA_REALLOC;  // backing store was reallocated
 extern const size_t CSSA_FAILED; // failed to allocate ram
 extern const size_t CSSA_HEAP; // memory is on the heap
 extern const size_t CSSA_SKIPPED; // changes skipped for a reason
+extern const size_t CSSA_INLINE; // string lives in the inline buffer
+extern const size_t CSSA_ARENA; // string lives in the action's arena
+extern const size_t CSSA_SHARED; // copy-on-write buffer shared by copies
+extern const size_t CSSA_SLICE; // unterminated range of a shared buffer
+extern const size_t CSSA_INDEXED; // code point index attached, see below
+extern const size_t CSSA_MAPPED; // read-only mapping of a file
+
+// Storage mode bits; cssa_flags and cssa_testAndClear leave these intact
+extern const size_t CSSA_STORAGE;
+
+// Bytes of inline storage, terminator included, available to short strings
+// before a separate heap buffer is needed. Together with `recalloced` it
+// fills the space before `reserved`, so the fields and inline bytes share
+// the first 64 bytes. Longer strings keep two pointers in it, so it must
+// hold at least 2 * sizeof(void *).
+#ifndef CS_INLINE_SIZE
+#define CS_INLINE_SIZE 22
+#endif
+
+// Allocator table used for every StringAction header and buffer. Sizes are
+// passed back on reallocate and release so size-class allocators need no
+// per-block headers.
+typedef struct cs_allocator {
+  void *(*allocate)(void *context, size_t size);
+  void *(*reallocate)(
+    void *context, 
+    void *memory, 
+    size_t oldSize, 
+    size_t newSize
+  );
+  void (*release)(void *context, void *memory, size_t size);
+  void *context;     // user data handed to each call
+} cs_allocator;
+
+// Allocation counters reported by the arena and pool allocators; the
+// difference between reserved and requested is the fragmentation overhead
+typedef struct cs_allocStats {
+  size_t requested;  // live bytes asked for by callers
+  size_t reserved;   // bytes held from the parent allocator
+  size_t blocks;     // live allocations
+  size_t peak;       // high-water mark of reserved
+} cs_allocStats;
+
+// malloc/realloc/free; also the default until cs_setDefaultAllocator
+extern const cs_allocator CS_HEAP_ALLOCATOR;
+
+// Arenas hand out StringActions and their buffers from bump-pointer chunks
+// and release all of them at once with cs_arena_reset or cs_arena_destroy.
+typedef struct cs_arena cs_arena;
+
+// Pools carve size classes tuned for short strings out of 64 KiB slabs and
+// recycle freed blocks; a pool is not thread safe, so use one per thread.
+typedef struct cs_pool cs_pool;
 
 typedef struct StringAction {
   char *string;      // string pointer
   size_t length;     // length of string up to first null character
-  size_t size;       // new allocation size
+  size_t size;       // capacity of the backing store, including terminator
   size_t lastAction; // last action taken constant
+  char buffer[CS_INLINE_SIZE]; // inline storage when CSSA_INLINE is set
   BOOL recalloced;   // re/c/alloc'ed?
-  void *reserved;    // for extensions and future changes
+  void *reserved;    // cached cs_hash, 0L until computed
+  const cs_allocator *allocator; // source of the header and buffer
 } StringAction;
 
+// A borrowed run of bytes with its length; it owns nothing and need not be
+// NUL terminated. Passing views between operations means no step has to
+// scan for the end of the string again.
+typedef struct cs_view {
+  const char *ptr;   // first byte
+  size_t len;        // number of bytes
+} cs_view;
+
+// An inline string points into its own StringAction, so duplicate one with
+// cs_copy rather than by assigning the structure.
+
 // Prototypes
 void          cs_heapAction(StringAction *sa, char *string);
 StringAction  *cs_new(size_t size);
@@ -65,12 +138,562 @@ void          cs_freeAndRenew(
                 size_t maxSize
               );
 
+// Allocator prototypes. New StringActions capture the default allocator
+// when they are created and keep using it for their whole life; the
+// *Using constructors pick one explicitly (0L meaning the default).
+// Renewing an action with a different allocator is only meant for actions
+// whose header the caller owns, as cs_free releases the header through the
+// action's current allocator.
+const cs_allocator *cs_defaultAllocator(void);
+void          cs_setDefaultAllocator(const cs_allocator *allocator);
+StringAction  *cs_newUsing(const cs_allocator *allocator, size_t size);
+StringAction  *cs_copyUsing(
+                const cs_allocator *allocator, 
+                const char *string
+              );
+StringAction  *cs_copyAndResizeUsing(
+                const cs_allocator *allocator,
+                const char *string,
+                size_t maxSize,
+                StringAction *useAction
+              );
+void          cs_freeAndRenewUsing(
+                const cs_allocator *allocator,
+                StringAction *action,
+                const char *string,
+                size_t maxSize
+              );
+cs_pool       *cs_pool_create(const cs_allocator *parent);
+void          cs_pool_destroy(cs_pool *pool);
+const cs_allocator *cs_pool_allocator(cs_pool *pool);
+void          cs_pool_stats(cs_pool *pool, cs_allocStats *stats);
+
+// Arena prototypes; the StringAction variants mirror their heap
+// counterparts, and strings built in an arena grow in place while they are
+// its most recent allocation. cs_free on an arena StringAction only gives
+// memory back when it was the arena's latest allocation.
+cs_arena      *cs_arena_create(size_t chunkSize);
+void          cs_arena_reset(cs_arena *arena);
+void          cs_arena_destroy(cs_arena *arena);
+const cs_allocator *cs_arena_allocator(cs_arena *arena);
+void          cs_arena_stats(cs_arena *arena, cs_allocStats *stats);
+void          *cs_arena_alloc(cs_arena *arena, size_t size);
+void          *cs_arena_grow(
+                cs_arena *arena,
+                void *memory,
+                size_t oldSize,
+                size_t newSize
+              );
+BOOL          cs_arena_owns(cs_arena *arena, const void *memory);
+StringAction  *cs_arena_new(cs_arena *arena, size_t size);
+StringAction  *cs_arena_copy(cs_arena *arena, const char *string);
+StringAction  *cs_arena_copyAndResize(
+                cs_arena *arena,
+                const char *string,
+                size_t maxSize
+              );
+StringAction  *cs_arena_copyAndResizeWith(
+                cs_arena *arena,
+                const char *string,
+                size_t maxSize,
+                StringAction *useAction
+              );
+void          cs_arena_freeAndRenew(
+                cs_arena *arena,
+                StringAction *action,
+                const char *string,
+                size_t maxSize
+              );
+char          *cs_arena_padEndWith(
+                cs_arena *arena,
+                const char *string,
+                size_t length,
+                const char *padString
+              );
+char          *cs_arena_padStartWith(
+                cs_arena *arena,
+                const char *string,
+                size_t length,
+                const char *padString
+              );
+char          *cs_arena_repeat(
+                cs_arena *arena,
+                const char *string,
+                unsigned int times
+              );
+
+// Substring search on explicit lengths; nothing is scanned for a NUL.
+// Short needles run a first/last byte SIMD filter (AVX2 or SSE2, picked at
+// runtime, with a scalar fallback) and long ones run Two-Way. Returns the
+// index of the first match or CS_NOT_FOUND.
+size_t        cs_search(
+                const char *haystack,
+                size_t haystackLength,
+                const char *needle,
+                size_t needleLength
+              );
+
+// Backward twin of cs_search: scans from the end of the haystack with the
+// same vector kernels, anchored on the last needle byte, and returns the
+// start of the last match. An empty needle matches at haystackLength.
+size_t        cs_searchLast(
+                const char *haystack,
+                size_t haystackLength,
+                const char *needle,
+                size_t needleLength
+              );
+
+// Bulk fill kernel shared by repeat and padding: writes `count` bytes of
+// the repeating pattern by doubling the already written prefix, so a fill
+// costs O(log n) memcpy calls instead of one copy per repetition.
+void          cs_fill(
+                char *dest,
+                size_t count,
+                const char *pattern,
+                size_t patternLength
+              );
+
+// Writes `times` copies of `string` and a terminator into a caller owned
+// buffer (stack, arena, ...). Returns the length written or CS_NOT_FOUND if
+// `capacity` cannot hold the result.
+size_t        cs_repeatInto(
+                const char *string,
+                size_t length,
+                unsigned int times,
+                char *buffer,
+                size_t capacity
+              );
+
+// Compiled search patterns for needles used across many haystacks. All of
+// the per-needle work (rare byte probes, Two-Way tables) happens once in
+// cs_pattern_compile. The functions share cs_indexOf's semantics, and
+// cs_pattern_count counts non-overlapping matches.
+typedef struct cs_pattern cs_pattern;
+
+cs_pattern    *cs_pattern_compile(const char *needle);
+cs_pattern    *cs_pattern_compileBytes(const char *needle, size_t length);
+void          cs_pattern_free(cs_pattern *pattern);
+size_t        cs_pattern_length(const cs_pattern *pattern);
+size_t        cs_pattern_search(
+                const cs_pattern *pattern,
+                const char *haystack,
+                size_t haystackLength
+              );
+size_t        cs_pattern_indexOf(
+                const cs_pattern *pattern, 
+                const char *haystack
+              );
+BOOL          cs_pattern_includes(
+                const cs_pattern *pattern, 
+                const char *haystack
+              );
+size_t        cs_pattern_count(const cs_pattern *pattern, const char *haystack);
+size_t        cs_pattern_countBytes(
+                const cs_pattern *pattern,
+                const char *haystack,
+                size_t haystackLength
+              );
+
+// Multi-needle matching over a compiled Aho-Corasick automaton. One pass
+// over the haystack finds every needle; the transition table is a flat
+// array of 32-bit entries whose columns are byte classes rather than all
+// 256 byte values. Matches are reported in order of where they end (the
+// longer needle first when several end together); empty needles match
+// once, at offset 0. cs_matchAll stores up to `capacity` matches and
+// returns how many there were in total.
+typedef struct cs_patternSet cs_patternSet;
+
+typedef struct cs_match {
+  size_t needle;     // index of the needle in the compiled list
+  size_t offset;     // where the match starts in the haystack
+} cs_match;
+
+cs_patternSet *cs_patternSet_compile(const char **needles, size_t count);
+void          cs_patternSet_free(cs_patternSet *set);
+BOOL          cs_includesAny(
+                const cs_patternSet *set,
+                const char *haystack,
+                cs_match *firstMatch
+              );
+BOOL          cs_includesAnyBytes(
+                const cs_patternSet *set,
+                const char *haystack,
+                size_t haystackLength,
+                cs_match *firstMatch
+              );
+size_t        cs_matchAll(
+                const cs_patternSet *set,
+                const char *haystack,
+                cs_match *matches,
+                size_t capacity
+              );
+size_t        cs_matchAllBytes(
+                const cs_patternSet *set,
+                const char *haystack,
+                size_t haystackLength,
+                cs_match *matches,
+                size_t capacity
+              );
+
+// View prototypes. Conversions to and from StringAction use its cached
+// length, and operations producing new text return a new StringAction.
+cs_view       cs_viewOf(const char *string);
+cs_view       cs_viewOfBytes(const char *bytes, size_t length);
+cs_view       cssa_view(const StringAction *action);
+cs_view       cs_slice(const char *string, size_t start, size_t end);
+cs_view       cssa_slice(const StringAction *action, size_t start, size_t end);
+cs_view       cs_view_slice(cs_view string, size_t start, size_t end);
+StringAction  *cs_copyView(cs_view view);
+StringAction  *cs_copyViewUsing(const cs_allocator *allocator, cs_view view);
+StringAction  *cssa_concatView(StringAction *action, cs_view extra);
+StringAction  *cssa_concatViews(
+                StringAction *action,
+                const cs_view *parts,
+                size_t count
+              );
+size_t        cs_view_indexOf(cs_view haystack, cs_view needle);
+size_t        cs_view_lastIndexOf(cs_view haystack, cs_view needle);
+size_t        cs_view_lastIndexOfFrom(
+                cs_view haystack,
+                cs_view needle,
+                size_t fromIndex
+              );
+BOOL          cs_view_includes(cs_view haystack, cs_view needle);
+BOOL          cs_view_includesAt(
+                cs_view haystack, 
+                cs_view needle, 
+                size_t fromIndex
+              );
+BOOL          cs_view_startsWith(cs_view string, cs_view prefix);
+BOOL          cs_view_endsWith(cs_view string, cs_view ending);
+int           cs_view_compare(cs_view a, cs_view b);
+BOOL          cs_view_equals(cs_view a, cs_view b);
+StringAction  *cs_view_concat(cs_view a, cs_view b);
+StringAction  *cs_view_join(
+                const cs_view *parts,
+                size_t count,
+                cs_view separator
+              );
+StringAction  *cs_view_padEnd(cs_view string, size_t length, cs_view pad);
+StringAction  *cs_view_padStart(cs_view string, size_t length, cs_view pad);
+StringAction  *cs_view_repeat(cs_view string, unsigned int times);
+
+// Lazy composition of concat, pad and repeat results. Segments are only
+// recorded; strings are referenced rather than copied and must outlive the
+// composition. cs_compose_write gathers the segments into writev calls so
+// the combined bytes are never built, and cs_compose_materialize produces
+// a StringAction only when one is needed. Pads apply to everything
+// recorded so far. Recording failures are sticky and make write and
+// materialize fail.
+typedef struct cs_compose cs_compose;
+
+cs_compose    *cs_compose_create(void);
+cs_compose    *cs_compose_createUsing(const cs_allocator *allocator);
+void          cs_compose_reset(cs_compose *compose);
+void          cs_compose_free(cs_compose *compose);
+size_t        cs_compose_length(const cs_compose *compose);
+BOOL          cs_compose_failed(const cs_compose *compose);
+cs_compose    *cs_compose_append(
+                cs_compose *compose,
+                const char *bytes,
+                size_t length
+              );
+cs_compose    *cs_compose_concat(cs_compose *compose, const char *string);
+cs_compose    *cs_compose_concatView(cs_compose *compose, cs_view string);
+cs_compose    *cs_compose_repeat(
+                cs_compose *compose,
+                const char *string,
+                unsigned int times
+              );
+cs_compose    *cs_compose_padEnd(cs_compose *compose, size_t length);
+cs_compose    *cs_compose_padEndWith(
+                cs_compose *compose,
+                size_t length,
+                const char *padString
+              );
+cs_compose    *cs_compose_padStart(cs_compose *compose, size_t length);
+cs_compose    *cs_compose_padStartWith(
+                cs_compose *compose,
+                size_t length,
+                const char *padString
+              );
+ssize_t       cs_compose_write(const cs_compose *compose, int fd);
+size_t        cs_compose_writeInto(
+                const cs_compose *compose,
+                char *buffer,
+                size_t capacity
+              );
+StringAction  *cs_compose_materialize(const cs_compose *compose);
+
+// Ropes hold very large strings as a balanced tree of immutable, shared
+// chunks. Concat, prepend, padding and slicing cost O(log n) regardless of
+// the total size, and slices and copies share chunks with their source.
+// Searching runs across chunk boundaries without flattening; a contiguous
+// buffer is built only by cs_rope_flatten or cs_rope_writeInto. After an
+// allocation failure the rope reports cs_rope_failed and its contents are
+// unspecified.
+typedef struct cs_rope cs_rope;
+
+cs_rope       *cs_rope_create(void);
+cs_rope       *cs_rope_createUsing(const cs_allocator *allocator);
+cs_rope       *cssa_toRope(const StringAction *action);
+cs_rope       *cs_rope_copy(const cs_rope *rope);
+void          cs_rope_free(cs_rope *rope);
+size_t        cs_rope_length(const cs_rope *rope);
+BOOL          cs_rope_failed(const cs_rope *rope);
+char          cs_rope_charAt(const cs_rope *rope, size_t index);
+cs_rope       *cs_rope_append(
+                cs_rope *rope, 
+                const char *bytes, 
+                size_t length
+              );
+cs_rope       *cs_rope_concat(cs_rope *rope, const char *string);
+cs_rope       *cs_rope_concatRope(cs_rope *rope, const cs_rope *other);
+cs_rope       *cs_rope_prepend(
+                cs_rope *rope, 
+                const char *bytes, 
+                size_t length
+              );
+cs_rope       *cs_rope_padEndWith(
+                cs_rope *rope,
+                size_t length,
+                const char *padString
+              );
+cs_rope       *cs_rope_padStartWith(
+                cs_rope *rope,
+                size_t length,
+                const char *padString
+              );
+cs_rope       *cs_rope_slice(const cs_rope *rope, size_t start, size_t end);
+size_t        cs_rope_indexOf(const cs_rope *rope, const char *needle);
+size_t        cs_rope_indexOfBytes(
+                const cs_rope *rope,
+                const char *needle,
+                size_t needleLength
+              );
+BOOL          cs_rope_includes(const cs_rope *rope, const char *needle);
+size_t        cs_rope_writeInto(
+                const cs_rope *rope, 
+                char *buffer, 
+                size_t capacity
+              );
+StringAction  *cs_rope_flatten(const cs_rope *rope);
+
+// Hashing and comparison. cs_hash caches its result in the StringAction's
+// `reserved` slot and every mutating cssa_ call clears it. cs_equals
+// rejects strings in O(1) when their lengths or cached hashes differ, and
+// otherwise makes a single memcmp. Hashes are never 0.
+size_t        cs_hashBytes(const char *bytes, size_t length);
+size_t        cs_view_hash(cs_view string);
+size_t        cs_hash(const StringAction *action);
+BOOL          cs_equals(const StringAction *a, const StringAction *b);
+int           cs_compare(const StringAction *a, const StringAction *b);
+
+// Interning maps byte content to one canonical StringAction per table, so
+// interned strings compare equal exactly when their pointers do. The table
+// is split into independently locked shards and each thread keeps a small
+// cache of recent lookups. Canonical strings are immutable, come with
+// cs_hash already cached, and are owned by the table until
+// cs_internTable_destroy. The allocator must be thread-safe if the table is
+// shared between threads. In the stats, `blocks` counts the interned
+// strings.
+typedef struct cs_internTable cs_internTable;
+
+cs_internTable *cs_internTable_create(void);
+cs_internTable *cs_internTable_createUsing(const cs_allocator *allocator);
+void          cs_internTable_destroy(cs_internTable *table);
+size_t        cs_internTable_count(const cs_internTable *table);
+void          cs_internTable_stats(
+                const cs_internTable *table, 
+                cs_allocStats *stats
+              );
+const StringAction *cs_intern(cs_internTable *table, const char *string);
+const StringAction *cs_internBytes(
+                cs_internTable *table,
+                const char *bytes,
+                size_t length
+              );
+const StringAction *cs_internView(cs_internTable *table, cs_view string);
+
+// UTF-8 code points
+//
+// cs_charAt and the pad functions count bytes; these count code points.
+// Code point indexes are found by counting lead bytes 16 at a time. Given a
+// StringAction of a few hundred bytes or more, the first lookup attaches a
+// sparse index (CSSA_INDEXED) of every 64th code point's offset, so later
+// lookups walk at most 63 code points. Any mutation drops the index.
+// Lookups return -1 past the end or on a malformed sequence.
+BOOL          cs_isValidUTF8(const char *bytes, size_t length);
+size_t        cs_lengthCodePoints(const char *string);
+size_t        cs_view_lengthCodePoints(cs_view string);
+int           cs_codePointAt(const char *string, size_t index);
+size_t        cssa_lengthCodePoints(StringAction *action);
+int           cssa_codePointAt(StringAction *action, size_t codePoint);
+char          *cssa_padEndCodePoints(
+                StringAction *action,
+                size_t length,
+                const char *padString
+              );
+char          *cssa_padStartCodePoints(
+                StringAction *action,
+                size_t length,
+                const char *padString
+              );
+char          *cs_padEndCodePoints(
+                char *string, 
+                size_t length, 
+                const char *padString
+              );
+char          *cs_padStartCodePoints(
+                char *string, 
+                size_t length, 
+                const char *padString
+              );
+
+// ASCII case and whitespace. Only A-Z/a-z change case and only space, \t,
+// \n, \v, \f and \r are trimmed; other bytes, UTF-8 included, pass through.
+// The CI functions match ignoring case without a lowered copy. Trimming a
+// slice only narrows it, and the view functions never copy.
+size_t        cs_searchCI(
+                const char *haystack,
+                size_t haystackLength,
+                const char *needle,
+                size_t needleLength
+              );
+size_t        cs_indexOfCI(const char *haystack, const char *needle);
+BOOL          cs_includesCI(const char *haystack, const char *needle);
+BOOL          cs_endsWithCI(const char *string, const char *ending);
+size_t        cs_view_indexOfCI(cs_view haystack, cs_view needle);
+BOOL          cs_view_includesCI(cs_view haystack, cs_view needle);
+BOOL          cs_view_endsWithCI(cs_view string, cs_view ending);
+BOOL          cs_view_equalsCI(cs_view a, cs_view b);
+char          *cs_toLower(char *string);
+char          *cs_toUpper(char *string);
+size_t        cs_toLowerInto(
+                const char *string,
+                size_t length,
+                char *buffer,
+                size_t capacity
+              );
+size_t        cs_toUpperInto(
+                const char *string,
+                size_t length,
+                char *buffer,
+                size_t capacity
+              );
+char          *cssa_toLower(StringAction *action);
+char          *cssa_toUpper(StringAction *action);
+cs_view       cs_view_trim(cs_view string);
+cs_view       cs_view_trimStart(cs_view string);
+cs_view       cs_view_trimEnd(cs_view string);
+char          *cssa_trim(StringAction *action);
+char          *cssa_trimStart(StringAction *action);
+char          *cssa_trimEnd(StringAction *action);
+char          *cs_trim(char *string);
+char          *cs_trimStart(char *string);
+char          *cs_trimEnd(char *string);
+
+// Files. cs_mapFile returns a CSSA_MAPPED action whose bytes are the file's
+// pages, mapped read-only; `size` is the length of the mapping. A zeroed
+// byte always follows the file, so the cs_ string functions work on
+// `string` directly. cssa_copy and cssa_substring share the mapping rather
+// than copying it, and it is unmapped when the last of them is freed. The
+// first mutation copies the bytes into the action's allocator, as it does
+// for shared buffers. The file must not shrink while it is mapped.
+//
+// A cs_reader reads descriptors that cannot be mapped, such as pipes, a
+// chunk at a time into one reused buffer. cs_reader_next hands out views
+// that stay valid until the next call. cs_reader_indexOf searches onward
+// from the last match with a cs_matcher, keeping only needleLength - 1
+// bytes across reads, and returns stream offsets; chunks handed out later
+// start after the first byte of the match. As with cs_matcher, an empty
+// needle matches once, where the search starts.
+typedef struct cs_reader cs_reader;
+
+StringAction  *cs_mapFile(const char *path);
+StringAction  *cs_mapFileUsing(const cs_allocator *allocator, const char *path);
+cs_reader     *cs_reader_open(const char *path);
+cs_reader     *cs_reader_openFd(int fd);
+cs_reader     *cs_reader_openUsing(
+                const cs_allocator *allocator, 
+                int fd, 
+                size_t chunkSize
+              );
+void          cs_reader_free(cs_reader *reader);
+BOOL          cs_reader_failed(const cs_reader *reader);
+size_t        cs_reader_offset(const cs_reader *reader);
+BOOL          cs_reader_next(cs_reader *reader, cs_view *chunk);
+size_t        cs_reader_indexOf(cs_reader *reader, const char *needle);
+size_t        cs_reader_indexOfBytes(
+                cs_reader *reader,
+                const char *needle,
+                size_t needleLength
+              );
+BOOL          cs_reader_includes(cs_reader *reader, const char *needle);
+
+// Incremental search over a stream fed a chunk at a time. Each call to
+// cs_matcher_feed reports the stream offset of every occurrence of the
+// needle, overlapping ones included, that ends within the chunk, storing
+// up to `capacity` of them and returning how many there were. Only the
+// last needleLength - 1 bytes of the stream are kept between calls, so
+// memory stays constant however much is fed. Chunks are searched with the
+// same kernels as cs_indexOf. An empty needle matches once, at offset 0.
+typedef struct cs_matcher cs_matcher;
+
+cs_matcher    *cs_matcher_create(const char *needle);
+cs_matcher    *cs_matcher_createBytes(const char *needle, size_t length);
+void          cs_matcher_free(cs_matcher *matcher);
+void          cs_matcher_reset(cs_matcher *matcher);
+size_t        cs_matcher_offset(const cs_matcher *matcher);
+size_t        cs_matcher_feed(
+                cs_matcher *matcher,
+                const char *chunk,
+                size_t length,
+                size_t *offsets,
+                size_t capacity
+              );
+
 // Prototypes working directly with StringAction structures
+//
+// A StringAction is a builder: `length` is trusted rather than re-scanned
+// and `size` is the real capacity, grown geometrically on append. Code that
+// writes into `string` directly should call cssa_sync afterwards.
+//
+// cssa_copy shares the buffer instead of copying it; the first copy moves
+// it behind a reference count once. Shared buffers are read-only. Every
+// mutating cssa_ function splits its own buffer off first, and code that
+// writes into `string` directly must call cssa_makeWritable before doing so.
+// The count is atomic, so copies may be handed to other threads.
+//
+// cssa_substring returns a CSSA_SLICE action that points into the parent's
+// shared buffer. A slice is not NUL terminated; read it through its length
+// or cssa_view. cssa_cstr, or any mutation, gives it a copy of its own.
 void          cssa_flags(StringAction *action, size_t flags);
 void          cssa_modFlags(StringAction *action, size_t flags);
 BOOL          cssa_test(StringAction *action, size_t flag);
 BOOL          cssa_testAndClear(StringAction *action, size_t flag);
 StringAction  *cssa_concat(StringAction *string, const char *extra);
+StringAction  *cssa_append(
+                StringAction *action,
+                const char *bytes,
+                size_t length
+              );
+StringAction  *cssa_concatMany(
+                StringAction *action,
+                const char **parts,
+                size_t count
+              );
+StringAction  *cssa_copy(StringAction *action);
+StringAction  *cssa_makeWritable(StringAction *action);
+StringAction  *cssa_substring(
+                StringAction *action, 
+                size_t start, 
+                size_t end
+              );
+const char    *cssa_cstr(StringAction *action);
+StringAction  *cssa_reserve(StringAction *action, size_t capacity);
+StringAction  *cssa_shrinkToFit(StringAction *action);
+StringAction  *cssa_sync(StringAction *action);
 char          *cssa_padEndWith(
                 StringAction *action,
                 size_t length,
@@ -82,8 +705,17 @@ char          *cssa_padStartWith(
                 const char *padString
               );    
 char          *cssa_repeat(StringAction *action, unsigned int times);                  
+char          *cssa_repeatInto(
+                StringAction *action,
+                unsigned int times,
+                char *buffer,
+                size_t capacity
+              );
         
 // Prototypes working directly with strings; may use StringAction underneath
+//
+// Functions that grow a `char *` heap string may realloc it; use the
+// returned pointer in its place.
 char          cs_charAt(const char *string, size_t index);
 int           cs_charCodeAt(const char *string, size_t index);
 BOOL          cs_endsWith(const char *string, const char *ending);
@@ -95,6 +727,17 @@ BOOL          cs_includesAt(
                 size_t fromIndex
               );
 size_t        cs_indexOf(const char *haystack, const char *needle);
+char          *cs_join(
+                const char **parts, 
+                size_t count, 
+                const char *separator
+              );
+size_t        cs_lastIndexOf(const char *haystack, const char *needle);
+size_t        cs_lastIndexOfFrom(
+                const char *haystack,
+                const char *needle,
+                size_t fromIndex
+              );
 char          *cs_padEnd(char *string, size_t length);
 char          *cs_padEndWith(
                 char *string,
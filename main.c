@@ -1,3 +1,8 @@
+// fileno are POSIX; strict ISO modes hide them otherwise
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
 #include "cstr.h"
 
 // Testbed
@@ -37,6 +42,11 @@ int main(int argc, char **argv) {
       string,
       cs_endsWith(string, "LLE") ? "yes" : "no"
     );
+    printf(
+      "Does %s end with 'LLE', ignoring case? %s\n",
+      string,
+      cs_endsWithCI(string, "LLE") ? "yes" : "no"
+    );
   }
 
   // concat
@@ -44,6 +54,7 @@ int main(int argc, char **argv) {
     cssa_concat(stringMeta, " is great");
     printf("Concatenated output is '%s'\n", stringMeta->string);    
     cs_freeAndRenew(stringMeta, "Brielle", 0L);
+    string = stringMeta->string;
   }
   
   // includes
@@ -60,6 +71,12 @@ int main(int argc, char **argv) {
       "IEL",
       cs_includes(string, "IEL") ? "yes" : "no"
     );
+    printf(
+      "'%s' contains '%s', ignoring case? %s\n", 
+      string,
+      "IEL",
+      cs_includesCI(string, "IEL") ? "yes" : "no"
+    );
   }
 
   // includes, position
@@ -97,17 +114,19 @@ int main(int argc, char **argv) {
 
   // lastIndexOf
   {
-    // size_t index = -1;
-    // 
-    // index = cs_indexOf(string, "e");
-    // if (~index) {
-    //   while (cs_includesAt(string, "e", index)) {
-    //     printf("%s (%ld)\n", string, index);
-    //     index += index + cs_indexOf(&string[index], "e");
-    //   }
-    // }
-    // 
-    // printf("The last index of '%s' should be %ld\n", "e", index);
+    printf(
+      "Last index of '%s' in '%s' is %ld\n",
+      "e",
+      string,
+      cs_lastIndexOf(string, "e")
+    );
+    
+    printf(
+      "Last index of '%s' in '%s' at or before 5 is %ld\n",
+      "e",
+      string,
+      cs_lastIndexOfFrom(string, "e", 5)
+    );
   }
 
   // padEnd
@@ -120,14 +139,13 @@ int main(int argc, char **argv) {
     strcpy(tempString, "1234567");
     strcpy(tempString2, tempString);
     
-    // test with a heap string using spaces
-    printf("The end padded string is '%s'\n", cs_padEnd(tempString, 10));
+    // test with a heap string using spaces; the buffer may be reallocated
+    tempString = cs_padEnd(tempString, 10);
+    printf("The end padded string is '%s'\n", tempString);
 
     // test with a heap string using periods
-    printf(
-      "The end padded string is '%s'\n", 
-      cs_padEndWith(tempString2, 10, "*")
-    );
+    tempString2 = cs_padEndWith(tempString2, 10, "*");
+    printf("The end padded string is '%s'\n", tempString2);
     
     // test with the primary string
     cssa_padEndWith(stringMeta, 10, CS_DEFAULT_PADSTRING);
@@ -151,14 +169,13 @@ int main(int argc, char **argv) {
     strcpy(tempString, "1234567");
     strcpy(tempString2, tempString);
     
-    // test with a heap string using spaces
-    printf("The end padded string is '%s'\n", cs_padStart(tempString, 10));
+    // test with a heap string using spaces; the buffer may be reallocated
+    tempString = cs_padStart(tempString, 10);
+    printf("The end padded string is '%s'\n", tempString);
 
     // test with a heap string using periods
-    printf(
-      "The end padded string is '%s'\n", 
-      cs_padStartWith(tempString2, 10, "*")
-    );
+    tempString2 = cs_padStartWith(tempString2, 10, "*");
+    printf("The end padded string is '%s'\n", tempString2);
     
     // test with the primary string
     cssa_padStartWith(stringMeta, 10, CS_DEFAULT_PADSTRING);
@@ -188,6 +205,125 @@ int main(int argc, char **argv) {
     free(sa3);
   }
 
+  // cs_arena
+  {
+    cs_arena *arena = cs_arena_create(0);
+    StringAction *name = cs_arena_copy(arena, stringMeta->string);
+    
+    cssa_concat(name, " lives in an arena");
+    printf("%s\n", name->string);
+    printf("%s\n", cs_arena_padStartWith(arena, "42", 6, "0"));
+    
+    // everything allocated above is released at once
+    cs_arena_destroy(arena);
+  }
+
+  // cs_compose
+  {
+    cs_compose *row = cs_compose_create();
+    
+    cs_compose_concat(row, stringMeta->string);
+    cs_compose_padEndWith(row, 12, ".");
+    cs_compose_repeat(row, "=", 4);
+    cs_compose_concat(row, "\n");
+    
+    // stdio has to be flushed before writing to the descriptor directly
+    fflush(stdout);
+    cs_compose_write(row, fileno(stdout));
+    cs_compose_free(row);
+  }
+
+  // cs_rope
+  {
+    cs_rope *doc = cssa_toRope(stringMeta);
+    cs_rope *tail;
+    StringAction *flat;
+    
+    cs_rope_concat(doc, " edits a very large document");
+    cs_rope_padStartWith(doc, cs_rope_length(doc) + 3, ">");
+    tail = cs_rope_slice(doc, 11, cs_rope_length(doc));
+    
+    flat = cs_rope_flatten(tail);
+    printf("'%s' found at %ld\n", flat->string, cs_rope_indexOf(doc, "very"));
+    
+    cs_free(flat);
+    cs_rope_free(tail);
+    cs_rope_free(doc);
+  }
+
+  // cssa_copy, copy on write
+  {
+    StringAction *original = cs_copy("a string too long to be kept inline");
+    StringAction *copy = cssa_copy(original);
+
+    // once the copy is gone the original owns the shared block alone
+    cs_free(copy);
+    cssa_concat(original, "!");
+    cssa_concat(original, " and grown well past the block it started in");
+    printf("After its copy was freed: '%s'\n", original->string);
+
+    cs_free(original);
+  }
+
+  // trim, toUpper
+  {
+    StringAction *padded = cs_copy("  \tquiet please \n");
+    
+    cssa_trim(padded);
+    cssa_toUpper(padded);
+    printf("Trimmed and raised: '%s'\n", padded->string);
+    
+    cs_free(padded);
+  }
+
+  // code points
+  {
+    StringAction *word = cs_copy("na\xC3\xAFve");
+    
+    cssa_padEndCodePoints(word, 8, "\xE2\x80\xA6");
+    printf(
+      "'%s' is %lu bytes, %lu code points; code point 2 is U+%04X\n",
+      word->string,
+      word->length,
+      cssa_lengthCodePoints(word),
+      cssa_codePointAt(word, 2)
+    );
+    
+    cs_free(word);
+  }
+
+  // cs_matcher
+  {
+    const char *chunks[] = { 
+      "a packet for Bri", 
+      "elle and one more for Brie", 
+      "lle" 
+    };
+    cs_matcher *matcher = cs_matcher_create(stringMeta->string);
+    size_t offsets[4];
+    size_t found = 0;
+    size_t i;
+    
+    // the needle straddles both chunk boundaries
+    for (i = 0; i < 3; i++) {
+      found += cs_matcher_feed(
+        matcher, 
+        chunks[i], 
+        strlen(chunks[i]), 
+        offsets + found, 
+        4 - found
+      );
+    }
+    printf(
+      "'%s' streamed in at %lu and %lu\n", 
+      stringMeta->string, 
+      offsets[0], 
+      offsets[1]
+    );
+    
+    cs_matcher_free(matcher);
+  }
+
   cs_free(stringMeta);
   return 0;
 }